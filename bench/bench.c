@@ -0,0 +1,87 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define CYCLES() __rdtsc() // reference cycles, they tick at a fixed rate whatever the clock speed
+#else
+#define CYCLES() 0
+#endif
+
+#include "bench.h"
+#include "console.h"
+#include "version.h"
+
+volatile long bench_sink;
+
+// every call to allocate() comes through here, the makefile links with --wrap=allocate
+static long allocations = 0;
+
+void* __real_allocate(void* data, size_t size);
+void* __wrap_allocate(void* data, size_t size) {
+	allocations++;
+	return __real_allocate(data, size);
+}
+
+static const char* filter = NULL;
+static bool first = true;
+
+bool bench_selected(const char* name) {
+	return filter == NULL || strstr(name, filter) != NULL;
+}
+
+double bench_run(const char* name, long iterations, bench_op op, void* arg) {
+	if (!bench_selected(name)) {
+		return 0;
+	}
+
+	// warm the caches and let buffers and arenas grow to the size they need
+	for (long i=0; i<iterations/10 + 1; i++) {
+		op(arg);
+	}
+
+	long allocations_start = allocations;
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	unsigned long long cycles_start = CYCLES();
+	for (long i=0; i<iterations; i++) {
+		op(arg);
+	}
+	unsigned long long cycles = CYCLES() - cycles_start;
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	double ns = (end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec);
+	double allocs = (double)(allocations - allocations_start) / iterations;
+	printf("%s\n    {\"name\": \"%s\", \"iterations\": %ld, \"ns_per_op\": %.2f, \"cycles_per_op\": %.1f, \"allocs_per_op\": %.3f}",
+		first ? "" : ",", name, iterations, ns / iterations, (double)cycles / iterations, allocs);
+	fflush(stdout);
+	first = false;
+	return allocs;
+}
+
+// results go to stdout as JSON, to diff between builds.  Give part of a name to only run those
+int main(int argc, char* argv[]) {
+	if (argc > 1) {
+		filter = argv[1];
+	}
+	clevel = CL_WARN;
+	corpus_init();
+
+	printf("{\n  \"version\": \"%s\",\n  \"compiler\": \"%s\",\n  \"results\": [", VERSION, __VERSION__);
+	bench_buffer();
+	bench_scanner();
+	bench_uri();
+	bench_request();
+	bench_response();
+	bench_dates();
+	bench_send();
+	bench_dispatch();
+	bench_client();
+	printf("\n  ]\n}\n");
+
+	corpus_free();
+	return 0;
+}
@@ -0,0 +1,44 @@
+#ifndef TINN_BENCH_H
+#define TINN_BENCH_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// a tiny harness for timing the hot helpers.  Each benchmark runs a fixed number of times,
+// after a warm up, and reports time, cycles and calls to allocate() per op as a line of JSON.
+// The calls to allocate() per op are returned too, 0 when it didn't run
+typedef void (*bench_op)(void* arg);
+
+double bench_run(const char* name, long iterations, bench_op op, void* arg);
+// whether a benchmark runs this time, for ones that take a while to set up
+bool bench_selected(const char* name);
+
+// stops the compiler throwing away work whose result isn't used
+extern volatile long bench_sink;
+
+// requests to parse, the whole request and its target
+typedef struct {
+	const char* name;
+	const char* data;
+	size_t length;
+	const char* target;
+	size_t target_len;
+} CorpusEntry;
+
+extern CorpusEntry* corpus;
+extern size_t corpus_count;
+
+void corpus_init();
+void corpus_free();
+
+void bench_buffer();
+void bench_scanner();
+void bench_uri();
+void bench_request();
+void bench_response();
+void bench_dates();
+void bench_send();
+void bench_dispatch();
+void bench_client();
+
+#endif
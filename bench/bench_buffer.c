@@ -0,0 +1,40 @@
+#include <string.h>
+
+#include "bench.h"
+#include "buffer.h"
+
+static const char* line = "Content-Type: text/html; charset=utf-8\r\n";
+
+static void append(void* arg) {
+	Buffer* buf = arg;
+	buf_reset(buf);
+	for (int i=0; i<16; i++) {
+		buf_append_str(buf, line);
+	}
+	bench_sink += buf->length;
+}
+
+static void append_format(void* arg) {
+	Buffer* buf = arg;
+	buf_reset(buf);
+	buf_append_format(buf, "HTTP/1.1 %d %s\r\nContent-Length: %ld\r\n", 200, "OK", 123456L);
+	bench_sink += buf->length;
+}
+
+// what pipelined requests do, a request's worth off the front of a full buffer
+static void consume(void* arg) {
+	Buffer* buf = arg;
+	buf_reset(buf);
+	buf_append(buf, corpus[1].data, corpus[1].length);
+	buf_append(buf, corpus[1].data, corpus[1].length);
+	buf_consume(buf, corpus[1].length);
+	bench_sink += buf->length;
+}
+
+void bench_buffer() {
+	Buffer* buf = buf_new(1024);
+	bench_run("buffer/append_16_lines", 2000000, append, buf);
+	bench_run("buffer/append_format", 2000000, append_format, buf);
+	bench_run("buffer/consume_request", 2000000, consume, buf);
+	buf_free(buf);
+}
@@ -0,0 +1,87 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <string.h>
+
+#include "bench.h"
+#include "client.h"
+#include "scanner.h"
+#include "console.h"
+
+// a keep-alive connection answering one request after another, through the client listener,
+// request parsing, a content generator and response_send, as the reactor does it.  Once
+// warmed up nothing should be allocated for a request
+#define PAGE "<!DOCTYPE html><html><head><title>Tinn</title></head><body><p>Hello</p></body></html>"
+#define REQUEST "GET /index.html HTTP/1.1\r\nHost: www.example.com\r\nUser-Agent: bench\r\nAccept: text/html\r\n\r\n"
+
+static Sockets* sockets;
+static int peer;
+static char answer[4096];
+
+static int page(void* state, Request* request, Response* response) {
+	(void)state;
+	(void)request;
+	response_status(response, 200);
+	response_header(response, "Cache-Control", "no-cache");
+	buf_append_str(response_content(response, "html"), PAGE);
+	return CONTENT_READY;
+}
+
+static void exchange(void* arg) {
+	(void)arg;
+	if (send(peer, REQUEST, strlen(REQUEST), 0) != (ssize_t)strlen(REQUEST)) {
+		PANIC("sending request");
+	}
+
+	// until the whole response is back
+	long length = 0;
+	long header = -1;
+	while (header < 0 || length < header + (long)strlen(PAGE)) {
+		sockets_dispatch(sockets, -1);
+		ssize_t n = recv(peer, answer + length, sizeof(answer) - length, MSG_DONTWAIT);
+		if (n > 0) {
+			length += n;
+			header = scan_header_end(answer, 0, length);
+		} else if (n == 0) {
+			PANIC("connection closed");
+		}
+	}
+	if (length != header + (long)strlen(PAGE) || strncmp(answer, "HTTP/1.1 200", 12) != 0) {
+		PANIC("unexpected response %.*s", (int)length, answer);
+	}
+	bench_sink += length;
+}
+
+void bench_client() {
+	if (!bench_selected("client/keepalive")) {
+		return;
+	}
+	int pair[2];
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, pair) != 0 || !set_non_blocking(pair[0])) {
+		PANIC("opening socket pair");
+	}
+	peer = pair[1];
+
+	sockets = sockets_new(sockets_backend(NULL), SOCKETS_DEFAULT_EVENTS);
+	ContentGenerators* content = content_generators_new(1);
+	content_generators_add(content, page, NULL);
+	ClientConfig config = {0};
+	client_config_prepare(&config);
+	ClientLoad load;
+	client_load_init(&load, 1);
+	client_new(sockets, pair[0], false, content, &config, &load);
+
+	if (bench_run("client/keepalive", 200000, exchange, NULL) > 0) {
+		PANIC("answering a keep-alive request allocates");
+	}
+
+	// the client closes when the peer does
+	close(peer);
+	while (load.connections > 0) {
+		sockets_dispatch(sockets, -1);
+	}
+	client_load_free(&load);
+	sockets_free(sockets);
+	content_generators_free(content);
+	buf_free(config.unavailable);
+}
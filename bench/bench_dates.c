@@ -0,0 +1,58 @@
+#define _DEFAULT_SOURCE
+#define _XOPEN_SOURCE 700
+
+#include <string.h>
+#include <time.h>
+
+#include "bench.h"
+#include "utils.h"
+
+static const char* date = "Tue, 12 Mar 2024 09:41:07 GMT";
+static time_t seconds = 1710236467;
+
+static void parse(void* arg) {
+	(void)arg;
+	bench_sink += from_imf_date(date, strlen(date));
+}
+
+// how from_imf_date used to do it
+static void parse_libc(void* arg) {
+	(void)arg;
+	struct tm tm;
+	memset(&tm, 0, sizeof(tm));
+	strptime(date, "%a, %d %b %Y %H:%M:%S GMT", &tm);
+	bench_sink += timegm(&tm);
+}
+
+// the same second over again, as the Date header does
+static void format_same(void* arg) {
+	(void)arg;
+	char buf[IMF_DATE_LEN];
+	to_imf_date(buf, IMF_DATE_LEN, seconds);
+	bench_sink += buf[5];
+}
+
+static void format_new(void* arg) {
+	(void)arg;
+	char buf[IMF_DATE_LEN];
+	to_imf_date(buf, IMF_DATE_LEN, seconds++);
+	bench_sink += buf[5];
+}
+
+static void format_libc(void* arg) {
+	(void)arg;
+	char buf[IMF_DATE_LEN];
+	struct tm tm;
+	time_t now = seconds++;
+	gmtime_r(&now, &tm);
+	strftime(buf, IMF_DATE_LEN, "%a, %d %b %Y %H:%M:%S GMT", &tm);
+	bench_sink += buf[5];
+}
+
+void bench_dates() {
+	bench_run("dates/parse", 5000000, parse, NULL);
+	bench_run("dates/parse_libc", 1000000, parse_libc, NULL);
+	bench_run("dates/format_same_second", 5000000, format_same, NULL);
+	bench_run("dates/format", 5000000, format_new, NULL);
+	bench_run("dates/format_libc", 1000000, format_libc, NULL);
+}
@@ -0,0 +1,110 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/resource.h>
+
+#include "bench.h"
+#include "net.h"
+#include "console.h"
+
+// one busy connection among many idle ones, what a wakeup costs as the idle ones grow.
+// An unconnected datagram socket is never readable, standing in for a keep-alive connection
+// waiting for its next request, and takes one descriptor where a connected pair takes two
+static Sockets* sockets;
+static int writer;
+static bool received;
+
+static void readable(Sockets* list, int index) {
+	char c;
+	if (sockets_recv(list, index, &c, 1) == 1) {
+		received = true;
+	}
+}
+
+static void idle(Sockets* list, int index) {
+	(void)list;
+	(void)index;
+	fprintf(stderr, "idle socket woke up\n");
+	exit(1);
+}
+
+static void wake(void* arg) {
+	(void)arg;
+	char c = 'x';
+	if (write(writer, &c, 1) != 1) {
+		return;
+	}
+	received = false;
+	while (!received) {
+		sockets_dispatch(sockets, -1);
+	}
+}
+
+static size_t open_limit() {
+	struct rlimit limit;
+	if (getrlimit(RLIMIT_NOFILE, &limit) != 0) {
+		return 1024;
+	}
+	limit.rlim_cur = limit.rlim_max;
+	setrlimit(RLIMIT_NOFILE, &limit);
+	getrlimit(RLIMIT_NOFILE, &limit);
+	return limit.rlim_cur;
+}
+
+static void dispatch_case(const SocketsBackend* backend, size_t count, const char* name) {
+	sockets = sockets_new(backend, SOCKETS_DEFAULT_EVENTS);
+	if (sockets->backend != backend) {
+		sockets_free(sockets);
+		return;
+	}
+
+	for (size_t i=0; i<count; i++) {
+		int fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+		if (fd < 0) {
+			PANIC("opening idle socket");
+		}
+		sockets_add(sockets, fd, idle);
+	}
+	int pair[2];
+	if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, pair) != 0) {
+		PANIC("opening socket pair");
+	}
+	writer = pair[1];
+	size_t active = sockets_add(sockets, pair[0], readable);
+
+	bench_run(name, 5000000 / count, wake, NULL);
+
+	sockets_close(sockets, active);
+	close(writer);
+	for (size_t i=0; i<count; i++) {
+		sockets_close(sockets, i);
+	}
+	// closes finish on the next dispatch for completion backends
+	sockets_dispatch(sockets, 0);
+	sockets_free(sockets);
+}
+
+void bench_dispatch() {
+	const char* backends[] = {"poll", "epoll", "io_uring"};
+	size_t counts[] = {100, 1000, 10000, 50000};
+	size_t limit = open_limit();
+	for (size_t i=0; i<sizeof(backends)/sizeof(*backends); i++) {
+		const SocketsBackend* backend = sockets_backend(backends[i]);
+		if (backend == NULL) {
+			continue;
+		}
+		for (size_t j=0; j<sizeof(counts)/sizeof(*counts); j++) {
+			char name[64];
+			snprintf(name, sizeof(name), "dispatch/%s/%zu_idle", backend->name, counts[j]);
+			if (!bench_selected(name)) {
+				continue;
+			}
+			if (counts[j] + 64 > limit) {
+				fprintf(stderr, "skipping %s, only %zu descriptors allowed\n", name, limit);
+				continue;
+			}
+			dispatch_case(backend, counts[j], name);
+		}
+	}
+}
@@ -0,0 +1,174 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bench.h"
+#include "request.h"
+#include "console.h"
+
+static Arena* arena;
+static Request* request;
+
+// as a connection does it, finish with the last request then read the next
+static void parse(void* arg) {
+	CorpusEntry* entry = arg;
+	request_next(request);
+	arena_reset(arena);
+	buf_append(request->buf, entry->data, entry->length);
+	request_parse(request);
+	bench_sink += request->content_start;
+}
+
+// a header arriving in pieces, parsed after each as request_recv does
+typedef struct {
+	CorpusEntry* entry;
+	size_t piece;
+	bool rescan;
+} PiecesCase;
+
+static void parse_pieces(void* arg) {
+	PiecesCase* pieces = arg;
+	request_next(request);
+	arena_reset(arena);
+	for (size_t sent=0; sent < pieces->entry->length; sent += pieces->piece) {
+		size_t left = pieces->entry->length - sent;
+		buf_append(request->buf, pieces->entry->data + sent, left < pieces->piece ? left : pieces->piece);
+		// forget how far the search got, looking for the end of the header from the start again
+		if (pieces->rescan) {
+			request->header_scanned = 0;
+		}
+		request_parse(request);
+	}
+	bench_sink += request->content_start;
+}
+
+// a request with a body and the next one behind it, arriving in pieces no bigger than there is
+// room for, as request_recv reads them.  The body has to come out of request_body as it went in
+// without piling up in the buffer, and the next request has to be found after it
+typedef struct {
+	const char* framing;
+	size_t piece;
+	char* data;
+	size_t length;
+	size_t next_start; // of the request after the body
+} BodyCase;
+
+#define BODY_SIZE 65536
+#define BODY_CHUNK 4000
+
+static char body[BODY_SIZE];
+
+static void make_body_case(BodyCase* body_case) {
+	Buffer* buf = buf_new(BODY_SIZE * 2);
+	bool chunked = strcmp(body_case->framing, "chunked") == 0;
+	if (chunked) {
+		buf_append_str(buf, "POST /upload HTTP/1.1\r\nHost: www.example.com\r\nTransfer-Encoding: chunked\r\n\r\n");
+	} else {
+		buf_append_str(buf, "POST /upload HTTP/1.1\r\nHost: www.example.com\r\nContent-Length: 65536\r\n\r\n");
+	}
+	for (size_t i=0; i<BODY_SIZE; i+=BODY_CHUNK) {
+		size_t n = BODY_SIZE - i < BODY_CHUNK ? BODY_SIZE - i : BODY_CHUNK;
+		if (chunked) {
+			char size[16];
+			snprintf(size, sizeof(size), "%zx\r\n", n);
+			buf_append_str(buf, size);
+		}
+		buf_append(buf, body + i, n);
+		if (chunked) {
+			buf_append_str(buf, "\r\n");
+		}
+	}
+	if (chunked) {
+		buf_append_str(buf, "0\r\n\r\n");
+	}
+	body_case->next_start = buf->length;
+	buf_append_str(buf, "GET /next HTTP/1.1\r\nHost: www.example.com\r\n\r\n");
+
+	body_case->length = buf->length;
+	body_case->data = malloc(buf->length);
+	memcpy(body_case->data, buf->data, buf->length);
+	buf_free(buf);
+}
+
+static void read_body(void* arg) {
+	BodyCase* body_case = arg;
+	request_next(request);
+	arena_reset(arena);
+
+	size_t sent = 0;
+	size_t taken = 0;
+	while (!request->complete || !request->body_done) {
+		if (sent == body_case->length) {
+			PANIC("%s body in pieces of %zu never finished", body_case->framing, body_case->piece);
+		}
+		size_t n = body_case->length - sent;
+		n = n < body_case->piece ? n : body_case->piece;
+		n = n < (size_t)buf_write_max(request->buf) ? n : (size_t)buf_write_max(request->buf);
+		memcpy(buf_write_ptr(request->buf), body_case->data + sent, n);
+		buf_advance_write(request->buf, n);
+		sent += n;
+
+		if (!request->complete) {
+			request_parse(request);
+			continue;
+		}
+		Token piece;
+		int found;
+		while ((found = request_body(request, &piece)) > 0) {
+			if (taken + piece.length > BODY_SIZE || memcmp(piece.start, body + taken, piece.length) != 0) {
+				PANIC("%s body in pieces of %zu came out wrong at %zu", body_case->framing, body_case->piece, taken);
+			}
+			taken += piece.length;
+		}
+		if (found < 0) {
+			PANIC("%s body in pieces of %zu turned down", body_case->framing, body_case->piece);
+		}
+	}
+	if (taken != BODY_SIZE || request->buf->size >= BODY_SIZE) {
+		PANIC("%s body in pieces of %zu, %zu bytes of it in a %ld byte buffer", body_case->framing, body_case->piece, taken, request->buf->size);
+	}
+
+	// what's left is the next request
+	request_next(request);
+	arena_reset(arena);
+	buf_append(request->buf, body_case->data + sent, body_case->length - sent);
+	request_parse(request);
+	if (!request->complete || !token_is(request->method, "GET")) {
+		PANIC("request after a %s body in pieces of %zu not found", body_case->framing, body_case->piece);
+	}
+	bench_sink += taken;
+}
+
+void bench_request() {
+	arena = arena_new(ARENA_DEFAULT_SIZE);
+	request = request_new(arena);
+	char name[64];
+	for (size_t i=0; i<corpus_count; i++) {
+		snprintf(name, sizeof(name), "request/parse/%s", corpus[i].name);
+		bench_run(name, 500000, parse, &corpus[i]);
+	}
+
+	// a byte at a time and a segment at a time, carrying on the search for the end of the
+	// header from header_scanned-3 against starting it again
+	PiecesCase pieces[] = {
+		{&corpus[7], 1, false}, {&corpus[7], 1, true},
+		{&corpus[7], 1448, false}, {&corpus[7], 1448, true},
+	};
+	for (size_t i=0; i<sizeof(pieces)/sizeof(*pieces); i++) {
+		snprintf(name, sizeof(name), "request/parse_pieces/%s/%zu/%s", pieces[i].entry->name, pieces[i].piece, pieces[i].rescan ? "rescan" : "incremental");
+		bench_run(name, pieces[i].piece > 1 ? 200000 : pieces[i].rescan ? 200 : 2000, parse_pieces, &pieces[i]);
+	}
+
+	for (size_t i=0; i<BODY_SIZE; i++) {
+		body[i] = i * 7 % 251;
+	}
+	BodyCase bodies[] = {{.framing = "length", .piece = 1}, {.framing = "length", .piece = 1448}, {.framing = "chunked", .piece = 1}, {.framing = "chunked", .piece = 1448}};
+	for (size_t i=0; i<sizeof(bodies)/sizeof(*bodies); i++) {
+		make_body_case(&bodies[i]);
+		snprintf(name, sizeof(name), "request/body/%s/%zu", bodies[i].framing, bodies[i].piece);
+		bench_run(name, bodies[i].piece > 1 ? 20000 : 200, read_body, &bodies[i]);
+		free(bodies[i].data);
+	}
+	request_free(request);
+	arena_free(arena);
+}
@@ -0,0 +1,37 @@
+#include "bench.h"
+#include "response.h"
+
+static Arena* arena;
+static Response* response;
+
+// what static content sends for a file, headers only
+static void file_headers(void* arg) {
+	(void)arg;
+	response_status(response, 200);
+	response_header(response, "Cache-Control", "no-cache");
+	response_date(response, "Last-Modified", 1700000000);
+	repsonse_content_headers(response, ".html", 12345);
+	response_batch(response);
+	bench_sink += response->batch->length;
+	response_reset(response);
+	arena_reset(arena);
+}
+
+// a redirect, no content
+static void redirect_headers(void* arg) {
+	(void)arg;
+	response_redirect(response, "/blog/");
+	response_batch(response);
+	bench_sink += response->batch->length;
+	response_reset(response);
+	arena_reset(arena);
+}
+
+void bench_response() {
+	arena = arena_new(ARENA_DEFAULT_SIZE);
+	response = response_new(arena);
+	bench_run("response/headers/file", 1000000, file_headers, NULL);
+	bench_run("response/headers/redirect", 1000000, redirect_headers, NULL);
+	response_free(response);
+	arena_free(arena);
+}
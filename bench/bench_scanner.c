@@ -0,0 +1,69 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "bench.h"
+#include "scanner.h"
+#include "headers.h"
+
+static void header_end(void* arg) {
+	CorpusEntry* entry = arg;
+	bench_sink += scan_header_end(entry->data, 0, entry->length);
+}
+
+// the header end as it was found before, a byte at a time
+static void header_end_bytes(void* arg) {
+	CorpusEntry* entry = arg;
+	const char* data = entry->data;
+	long found = -1;
+	for (size_t i=3; i<entry->length; i++) {
+		if (data[i] == '\n' && data[i-1] == '\r' && data[i-2] == '\n' && data[i-3] == '\r') {
+			found = i - 3;
+			break;
+		}
+	}
+	bench_sink += found;
+}
+
+static void lines_delimited(void* arg) {
+	CorpusEntry* entry = arg;
+	Scanner scanner = scanner_new(entry->data, entry->length);
+	Token line;
+	while ((line = scan_delimited(&scanner, &scan_crlf)).length > 0) {
+		Scanner header_scanner = scanner_new(line.start, line.length);
+		bench_sink += scan_delimited(&header_scanner, &scan_header_name).length;
+	}
+}
+
+// the same with the delimiters made on every call, as scan_token does
+static void lines_token(void* arg) {
+	CorpusEntry* entry = arg;
+	Scanner scanner = scanner_new(entry->data, entry->length);
+	Token line;
+	while ((line = scan_token(&scanner, "\r\n")).length > 0) {
+		Scanner header_scanner = scanner_new(line.start, line.length);
+		bench_sink += scan_token(&header_scanner, ": \t").length;
+	}
+}
+
+static const char* names[] = {"Host", "User-Agent", "accept", "Accept-Encoding", "Cookie", "sec-fetch-mode", "If-None-Match", "X-Request-Id"};
+
+static void lookup(void* arg) {
+	(void)arg;
+	for (size_t i=0; i<sizeof(names)/sizeof(*names); i++) {
+		bench_sink += header_lookup(names[i], strlen(names[i]));
+	}
+}
+
+void bench_scanner() {
+	char name[64];
+	for (size_t i=0; i<corpus_count; i++) {
+		snprintf(name, sizeof(name), "scanner/header_end/%s", corpus[i].name);
+		bench_run(name, 2000000, header_end, &corpus[i]);
+		snprintf(name, sizeof(name), "scanner/header_end_bytes/%s", corpus[i].name);
+		bench_run(name, 2000000, header_end_bytes, &corpus[i]);
+	}
+	bench_run("scanner/lines_delimited/browser", 1000000, lines_delimited, &corpus[1]);
+	bench_run("scanner/lines_token/browser", 1000000, lines_token, &corpus[1]);
+	bench_run("scanner/lines_delimited/header_8k", 200000, lines_delimited, &corpus[7]);
+	bench_run("scanner/header_lookup_8", 5000000, lookup, NULL);
+}
@@ -0,0 +1,129 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <netinet/in.h>
+
+#include "bench.h"
+#include "net.h"
+
+// a body sent over loopback TCP, copied or with MSG_ZEROCOPY, to a thread throwing it away.
+// A zerocopy send isn't done until the kernel says it has finished with the buffer
+typedef struct {
+	size_t size;
+	char* data;
+} SendCase;
+
+static Sockets* sockets;
+static int sender = -1;
+static size_t sender_index;
+static uint32_t zerocopy_next;
+static uint32_t zerocopy_done;
+
+static void* drain(void* arg) {
+	int fd = *(int*)arg;
+	char buf[65536];
+	while (recv(fd, buf, sizeof(buf), 0) > 0) {
+	}
+	return NULL;
+}
+
+static void wait_for(short events) {
+	struct pollfd pfd = {.fd = sender, .events = events};
+	poll(&pfd, 1, -1);
+}
+
+static void send_copy(void* arg) {
+	SendCase* send_case = arg;
+	size_t sent = 0;
+	while (sent < send_case->size) {
+		struct iovec iov = {.iov_base = send_case->data + sent, .iov_len = send_case->size - sent};
+		ssize_t n = sockets_send(sockets, sender_index, &iov, 1);
+		if (n > 0) {
+			sent += n;
+		} else {
+			wait_for(POLLOUT);
+		}
+	}
+}
+
+static void counted(void* arg, uint32_t first, uint32_t last) {
+	(void)arg;
+	zerocopy_done += last - first + 1;
+}
+
+static void send_zerocopy(void* arg) {
+	SendCase* send_case = arg;
+	size_t sent = 0;
+	while (sent < send_case->size) {
+		ssize_t n = sockets_send_zerocopy(sockets, sender_index, send_case->data + sent, send_case->size - sent);
+		if (n > 0) {
+			sent += n;
+			zerocopy_next++;
+		} else {
+			wait_for(POLLOUT);
+		}
+	}
+	while (zerocopy_done < zerocopy_next) {
+		wait_for(0);
+		sockets_zerocopy_reap(sockets, sender_index, counted, NULL);
+	}
+}
+
+static bool connect_pair(int* receiver) {
+	int server = socket(AF_INET, SOCK_STREAM, 0);
+	struct sockaddr_in address = {.sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_LOOPBACK)};
+	socklen_t size = sizeof(address);
+	if (server < 0 || bind(server, (struct sockaddr*)&address, size) != 0 || listen(server, 1) != 0 || getsockname(server, (struct sockaddr*)&address, &size) != 0) {
+		return false;
+	}
+	sender = socket(AF_INET, SOCK_STREAM, 0);
+	if (sender < 0 || connect(sender, (struct sockaddr*)&address, size) != 0) {
+		return false;
+	}
+	*receiver = accept(server, NULL, NULL);
+	close(server);
+	return *receiver >= 0 && set_non_blocking(sender);
+}
+
+static void nothing(Sockets* list, int index) {
+	(void)list;
+	(void)index;
+}
+
+void bench_send() {
+	int receiver;
+	pthread_t thread;
+	sockets = sockets_new(sockets_backend("poll"), SOCKETS_DEFAULT_EVENTS);
+	if (!connect_pair(&receiver) || pthread_create(&thread, NULL, drain, &receiver) != 0) {
+		fprintf(stderr, "unable to set up loopback connection\n");
+		return;
+	}
+	sender_index = sockets_add(sockets, sender, nothing);
+	bool zerocopy = sockets_zerocopy_enable(sockets, sender_index);
+
+	SendCase cases[] = {{65536, NULL}, {262144, NULL}, {1048576, NULL}, {8388608, NULL}};
+	long iterations[] = {20000, 5000, 1000, 100};
+	char name[64];
+	for (size_t i=0; i<sizeof(cases)/sizeof(cases[0]); i++) {
+		cases[i].data = malloc(cases[i].size);
+		memset(cases[i].data, 'x', cases[i].size);
+
+		snprintf(name, sizeof(name), "send/copy/%zuk", cases[i].size / 1024);
+		bench_run(name, iterations[i], send_copy, &cases[i]);
+		if (zerocopy) {
+			snprintf(name, sizeof(name), "send/zerocopy/%zuk", cases[i].size / 1024);
+			bench_run(name, iterations[i], send_zerocopy, &cases[i]);
+		}
+		free(cases[i].data);
+	}
+
+	sockets_rm(sockets, sender_index);
+	close(sender);
+	pthread_join(thread, NULL);
+	close(receiver);
+	sockets_free(sockets);
+}
@@ -0,0 +1,51 @@
+#include <stdio.h>
+
+#include "bench.h"
+#include "uri.h"
+#include "uri_cache.h"
+#include "arena.h"
+
+static Arena* arena;
+static UriCache* cache;
+
+static void parse(void* arg) {
+	CorpusEntry* entry = arg;
+	Token target = {.start = entry->target, .length = entry->target_len};
+	URI* uri = uri_new(arena, target);
+	bench_sink += uri->segments_count;
+	arena_reset(arena);
+}
+
+// a repeat target, copied back out of the cache
+static void cached(void* arg) {
+	CorpusEntry* entry = arg;
+	Token target = {.start = entry->target, .length = entry->target_len};
+	UriResolution resolution;
+	URI* uri = uri_cache_get(cache, arena, target, &resolution);
+	bench_sink += uri->segments_count;
+	arena_reset(arena);
+}
+
+void bench_uri() {
+	arena = arena_new(ARENA_DEFAULT_SIZE);
+	char name[64];
+	for (size_t i=0; i<corpus_count; i++) {
+		snprintf(name, sizeof(name), "uri/new/%s", corpus[i].name);
+		bench_run(name, 1000000, parse, &corpus[i]);
+	}
+
+	cache = uri_cache_new(URI_CACHE_DEFAULT_SIZE);
+	for (size_t i=0; i<corpus_count; i++) {
+		Token target = {.start = corpus[i].target, .length = corpus[i].target_len};
+		if (target.length > URI_CACHE_MAX_TARGET) {
+			continue; // not kept
+		}
+		uri_cache_put(cache, target, uri_new(arena, target));
+		arena_reset(arena);
+
+		snprintf(name, sizeof(name), "uri/cached/%s", corpus[i].name);
+		bench_run(name, 1000000, cached, &corpus[i]);
+	}
+	uri_cache_free(cache);
+	arena_free(arena);
+}
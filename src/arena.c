@@ -0,0 +1,89 @@
+#include <stdalign.h>
+#include <string.h>
+
+#include "utils.h"
+#include "arena.h"
+
+struct arena_spill {
+	ArenaSpill* next;
+	alignas(max_align_t) char data[];
+};
+
+#define ALIGN(n) (((n) + alignof(max_align_t) - 1) & ~(alignof(max_align_t) - 1))
+
+Arena* arena_new(size_t size) {
+	Arena* arena = allocate(NULL, sizeof(*arena));
+	arena->size = ALIGN(size > 0 ? size : ARENA_DEFAULT_SIZE);
+	arena->used = 0;
+	arena->data = allocate(NULL, arena->size);
+	arena->spilled = 0;
+	arena->spill = NULL;
+	return arena;
+}
+
+static void free_spill(Arena* arena) {
+	while (arena->spill != NULL) {
+		ArenaSpill* next = arena->spill->next;
+		free(arena->spill);
+		arena->spill = next;
+	}
+}
+
+void arena_free(Arena* arena) {
+	if (arena != NULL) {
+		free_spill(arena);
+		free(arena->data);
+		free(arena);
+	}
+}
+
+void* arena_alloc(Arena* arena, size_t size) {
+	size = ALIGN(size > 0 ? size : 1);
+	if (arena->size - arena->used >= size) {
+		void* data = arena->data + arena->used;
+		arena->used += size;
+		return data;
+	}
+
+	ArenaSpill* spill = allocate(NULL, sizeof(*spill) + size);
+	spill->next = arena->spill;
+	arena->spill = spill;
+	arena->spilled += size;
+	return spill->data;
+}
+
+// like realloc, the old space isn't given back until the reset
+void* arena_grow(Arena* arena, void* data, size_t old_size, size_t new_size) {
+	void* new_data = arena_alloc(arena, new_size);
+	if (data != NULL) {
+		memcpy(new_data, data, old_size < new_size ? old_size : new_size);
+	}
+	return new_data;
+}
+
+char* arena_strndup(Arena* arena, const char* str, size_t len) {
+	char* copy = arena_alloc(arena, len + 1);
+	memcpy(copy, str, len);
+	copy[len] = '\0';
+	return copy;
+}
+
+char* arena_strdup(Arena* arena, const char* str) {
+	return arena_strndup(arena, str, strlen(str));
+}
+
+// everything handed out is gone, usually this is just forgetting it
+void arena_reset(Arena* arena) {
+	if (arena->spill != NULL) {
+		free_spill(arena);
+		if (arena->size < ARENA_MAX_SIZE) {
+			size_t size = ALIGN(arena->size + arena->spilled);
+			arena->size = size < ARENA_MAX_SIZE ? size : ARENA_MAX_SIZE;
+			arena->data = allocate(arena->data, arena->size);
+		}
+		arena->spilled = 0;
+	}
+	arena->used = 0;
+}
+
+#undef ALIGN
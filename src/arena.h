@@ -0,0 +1,33 @@
+#ifndef TINN_ARENA_H
+#define TINN_ARENA_H
+
+#include <stddef.h>
+
+// memory for things that only last as long as a request, handed out from one block and all
+// given back at once with arena_reset.  What doesn't fit goes on the heap until the reset,
+// which then grows the block so it fits next time, up to ARENA_MAX_SIZE
+typedef struct arena_spill ArenaSpill;
+
+typedef struct {
+	size_t size;
+	size_t used;
+	char* data;
+
+	size_t spilled;
+	ArenaSpill* spill;
+} Arena;
+
+#define ARENA_DEFAULT_SIZE 2048
+#define ARENA_MAX_SIZE 65536
+
+Arena* arena_new(size_t size);
+void arena_free(Arena* arena);
+
+void* arena_alloc(Arena* arena, size_t size);
+void* arena_grow(Arena* arena, void* data, size_t old_size, size_t new_size);
+char* arena_strdup(Arena* arena, const char* str);
+char* arena_strndup(Arena* arena, const char* str, size_t len);
+
+void arena_reset(Arena* arena);
+
+#endif
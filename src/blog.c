@@ -52,12 +52,12 @@ static void read_posts(Blog* blog) {
 	Scanner line_scanner = scanner_new(buf->data, buf->length);
 	Token line;
 
-	while ((line = scan_token(&line_scanner, "\r\n")).length>0) {
+	while ((line = scan_delimited(&line_scanner, &scan_crlf)).length>0) {
 		Scanner field_scanner = scanner_new(line.start, line.length);
 
-		Token dir = scan_token(&field_scanner, "\t");
-		Token title = scan_token(&field_scanner, "\t");
-		Token date = scan_token(&field_scanner, "\t");
+		Token dir = scan_delimited(&field_scanner, &scan_tab);
+		Token title = scan_delimited(&field_scanner, &scan_tab);
+		Token date = scan_delimited(&field_scanner, &scan_tab);
 
 		// validate
 		if (dir.length==0 || title.length==0 || date.length==0) {
@@ -100,23 +100,6 @@ static void read_posts(Blog* blog) {
 	buf_free(buf);
 }
 
-static void reread_posts(Blog* blog) {
-	for (size_t i=0; i<blog->count; i++) {
-		buf_free(blog->posts[i].content);
-	}
-	blog->count = 0;
-	read_posts(blog);
-}
-
-static void check_post_date(struct post* post) {
-	time_t mod_date = get_mod_date(post->source);
-	if (mod_date > post->mod_date) {
-		buf_reset(post->content);
-		buf_append_file(post->content, post->source);
-		post->mod_date = mod_date;
-	}
-}
-
 static bool read_fragment(Blog* blog, size_t fragment, const char* path) {
 	blog->fragments[fragment].path = path;
 	blog->fragments[fragment].mod_date = get_mod_date(path);
@@ -125,9 +108,12 @@ static bool read_fragment(Blog* blog, size_t fragment, const char* path) {
 	return blog->fragments[fragment].buf != NULL;
 }
 
-Blog* blog_new() {
+static void blog_free(Blog* blog);
+
+static Blog* blog_new() {
 	Blog* blog = allocate(NULL, sizeof(*blog));
 	blog->mod_date = 0;
+	blog->refs = 1;
 
 	blog->size = 32;
 	blog->count = 0;
@@ -149,17 +135,87 @@ Blog* blog_new() {
 
 	return blog;
 }
-void blog_free(Blog* blog) {
+static void clear_blog(Blog* blog) {
+	for (size_t i=0; i<HF_COUNT; i++) {
+		buf_free(blog->fragments[i].buf);
+	}
+	for (size_t i=0; i<blog->count; i++) {
+		buf_free(blog->posts[i].content);
+	}
+	free(blog->posts);
+}
+
+static void blog_free(Blog* blog) {
 	if (blog != NULL) {
-		for (size_t i=0; i<HF_COUNT; i++) {
-			buf_free(blog->fragments[i].buf);
+		clear_blog(blog);
+		free(blog);
+	}
+}
+
+// freed once nothing is using it
+static void blog_release(Blog* blog) {
+	if (--blog->refs == 0) {
+		blog_free(blog);
+	}
+}
+
+BlogState* blog_state_new() {
+	Blog* blog = blog_new();
+	if (blog == NULL) {
+		return NULL;
+	}
+	BlogState* state = allocate(NULL, sizeof(*state));
+	state->blog = blog;
+	state->refreshing = false;
+	return state;
+}
+
+void blog_state_free(BlogState* state) {
+	if (state != NULL) {
+		blog_release(state->blog);
+		free(state);
+	}
+}
+
+// checking for changes stats every file, so it's done on a worker.  If anything changed the
+// whole blog is read again into a new copy, swapped in when we're called back
+struct blog_refresh {
+	Blog* blog;
+	Blog* fresh;
+};
+
+static bool blog_changed(Blog* blog) {
+	if (get_mod_date(POSTS_PATH) > blog->mod_date) {
+		return true;
+	}
+	for (size_t i=0; i<HF_COUNT; i++) {
+		if (get_mod_date(blog->fragments[i].path) > blog->fragments[i].mod_date) {
+			return true;
 		}
-		for (size_t i=0; i<blog->count; i++) {
-			buf_free(blog->posts[i].content);
+	}
+	for (size_t i=0; i<blog->count; i++) {
+		if (get_mod_date(blog->posts[i].source) > blog->posts[i].mod_date) {
+			return true;
 		}
-		free(blog->posts);		
-		free(blog);
 	}
+	return false;
+}
+
+static void refresh_blog(void* arg) {
+	struct blog_refresh* refresh = arg;
+	if (blog_changed(refresh->blog)) {
+		refresh->fresh = blog_new();
+	}
+}
+
+// pages still being sent from the old copy let it go when they finish
+static void replace_blog(BlogState* state, Blog* fresh) {
+	blog_release(state->blog);
+	state->blog = fresh;
+}
+
+static bool is_blog_path(const char* path) {
+	return strcmp(path, "/")==0 || strcmp(path, "/log")==0 || strcmp(path, "/" BLOG_DIR)==0 || strncmp(path, "/" BLOG_DIR "/", strlen(BLOG_DIR) + 2)==0;
 }
 
 static void compose_article(Buffer* buf, struct post* post) {
@@ -170,6 +226,49 @@ static void compose_article(Buffer* buf, struct post* post) {
 	buf_append_str(buf, "</article>\n");
 }
 
+// the home page and log are sent an article at a time, as fast as the client takes them,
+// all from the copy of the blog they started with
+struct blog_stream {
+	Blog* blog;
+	bool reverse;
+	size_t next; // the header, each post in turn, then the footer
+};
+
+static bool stream_articles(void* arg, Buffer* out) {
+	struct blog_stream* stream = arg;
+	Blog* blog = stream->blog;
+	if (out == NULL) {
+		blog_release(blog);
+		return false;
+	}
+
+	if (stream->next == 0) {
+		buf_append_buf(out, blog->fragments[HF_HEADER_1].buf);
+		buf_append_buf(out, blog->fragments[HF_HEADER_2].buf);
+	} else if (stream->next <= blog->count) {
+		size_t i = stream->reverse ? blog->count - stream->next : stream->next - 1;
+		TRACE_DETAIL("post %d \"%s\"", i, blog->posts[i].title);
+		if (stream->next > 1) {
+			buf_append_str(out, "<hr>\n");
+		}
+		compose_article(out, &(blog->posts[i]));
+	} else {
+		buf_append_buf(out, blog->fragments[HF_FOOTER].buf);
+		return false;
+	}
+	stream->next++;
+	return true;
+}
+
+static int stream_page(Blog* blog, bool reverse, Request* request, Response* response) {
+	struct blog_stream* stream = arena_alloc(request->arena, sizeof(*stream));
+	stream->blog = blog;
+	stream->reverse = reverse;
+	stream->next = 0;
+	blog->refs++;
+	return content_stream(request, response, stream_articles, stream, "html");
+}
+
 static bool method_allowed(Request* request, Response* response) {
 	if (!token_is(request->method, "GET") && !token_is(request->method, "HEAD")) {
 		TRACE("method not allowed");
@@ -180,46 +279,56 @@ static bool method_allowed(Request* request, Response* response) {
 	return true;
 }
 
-bool blog_content(void* state, Request* request, Response* response) {
-	TRACE("checking blog content");
-
-	Blog* blog = (Blog*)state;
+int blog_content(void* arg, Request* request, Response* response) {
+	BlogState* state = arg;
 
-	// check for changes
-	if (get_mod_date(POSTS_PATH) > blog->mod_date) {
-		reread_posts(blog);
+	struct blog_refresh* refresh = request->work_arg;
+	if (refresh != NULL) {
+		if (refresh->fresh != NULL) {
+			TRACE("blog changed, using the new copy");
+			replace_blog(state, refresh->fresh);
+		}
+		state->refreshing = false;
+	} else {
+		if (!is_blog_path(request->target->path)) {
+			return CONTENT_NOT_FOUND;
+		}
+		TRACE("checking blog content");
+
+		// check for changes, unless another request already is
+		if (!state->refreshing) {
+			state->refreshing = true;
+			refresh = arena_alloc(request->arena, sizeof(*refresh));
+			refresh->blog = state->blog;
+			refresh->fresh = NULL;
+			return content_defer(request, refresh_blog, refresh);
+		}
 	}
+	Blog* blog = state->blog;
 
 	time_t mod_date = blog->mod_date;
 	for (size_t i=0; i<HF_COUNT; i++) {
-		time_t fragment_mod_date = get_mod_date(blog->fragments[i].path);
-		if (fragment_mod_date > blog->fragments[i].mod_date) {
-			buf_reset(blog->fragments[i].buf);
-			buf_append_file(blog->fragments[i].buf, blog->fragments[i].path);
-			blog->fragments[i].mod_date = fragment_mod_date;
-		}
-		mod_date = max_time_t(mod_date, fragment_mod_date);
+		mod_date = max_time_t(mod_date, blog->fragments[i].mod_date);
 	}
 
 	// check home page
 	if (strcmp(request->target->path, "/")==0) {
 		// check this is a GET or HEAD request
 		if (!method_allowed(request, response)) {
-			return true;
+			return CONTENT_READY;
 		}
 
 		TRACE("generate home page");
 
 		// check modified date
 		for (size_t i=0; i<blog->count; i++) {
-			check_post_date(&(blog->posts[i]));
 			mod_date = max_time_t(mod_date, blog->posts[i].mod_date);
 		}
 
 		if (request->if_modified_since>0 && request->if_modified_since>=mod_date) {
 			TRACE("not modified, use cached version");
 			response_status(response, 304);
-			return true;
+			return CONTENT_READY;
 		}
 		
 		// generate page
@@ -227,46 +336,27 @@ bool blog_content(void* state, Request* request, Response* response) {
 		response_header(response, "Cache-Control", "no-cache");
 		response_date(response, "Last-Modified", mod_date);
 
-		Buffer* content = response_content(response, "html");
-		buf_append_buf(content, blog->fragments[HF_HEADER_1].buf);
-		buf_append_buf(content, blog->fragments[HF_HEADER_2].buf);
-
-		for (size_t i=0; i<blog->count; i++) {
-			TRACE_DETAIL("post %d \"%s\"", i, blog->posts[i].title);
-			if (i > 0) {
-				buf_append_str(content, "<hr>\n");
-			}
-			compose_article(content, &(blog->posts[i]));
-		}
-
-		buf_append_buf(content, blog->fragments[HF_FOOTER].buf);
-		
-		if (token_is(request->method, "HEAD")) {
-			repsonse_content_headers(response, "html", content->length);
-		}
-
-		return true;
+		return stream_page(blog, false, request, response);
 	}
 
 	// check log page
 	if (strcmp(request->target->path, "/log")==0) {
 		// check this is a GET or HEAD request
 		if (!method_allowed(request, response)) {
-			return true;
+			return CONTENT_READY;
 		}
 
 		TRACE("generate log page");
 
 		// check modified date
 		for (size_t i=0; i<blog->count; i++) {
-			check_post_date(&(blog->posts[i]));
 			mod_date = max_time_t(mod_date, blog->posts[i].mod_date);
 		}
 
 		if (request->if_modified_since>0 && request->if_modified_since>=mod_date) {
 			TRACE("not modified, use cached version");
 			response_status(response, 304);
-			return true;
+			return CONTENT_READY;
 		}
 		
 		// generate page
@@ -274,32 +364,14 @@ bool blog_content(void* state, Request* request, Response* response) {
 		response_header(response, "Cache-Control", "no-cache");
 		response_date(response, "Last-Modified", mod_date);
 
-		Buffer* content = response_content(response, "html");
-		buf_append_buf(content, blog->fragments[HF_HEADER_1].buf);
-		buf_append_buf(content, blog->fragments[HF_HEADER_2].buf);
-
-		for (ssize_t i=blog->count-1; i>=0; i--) {
-			TRACE_DETAIL("post %d \"%s\"", i, blog->posts[i].title);
-			if (i < (ssize_t)blog->count-1) {
-				buf_append_str(content, "<hr>\n");
-			}
-			compose_article(content, &(blog->posts[i]));
-		}
-
-		buf_append_buf(content, blog->fragments[HF_FOOTER].buf);
-		
-		if (token_is(request->method, "HEAD")) {
-			repsonse_content_headers(response, "html", content->length);
-		}
-
-		return true;
+		return stream_page(blog, true, request, response);
 	}
 
 	// check archive page
 	if (strcmp(request->target->path, "/" BLOG_DIR)==0) {
 		// check this is a GET or HEAD request
 		if (!method_allowed(request, response)) {
-			return true;
+			return CONTENT_READY;
 		}
 
 		TRACE("generate archive page");
@@ -308,7 +380,7 @@ bool blog_content(void* state, Request* request, Response* response) {
 		if (request->if_modified_since>0 && request->if_modified_since>=mod_date) {
 			TRACE("not modified, use cached version");
 			response_status(response, 304);
-			return true;
+			return CONTENT_READY;
 		}
 		
 		// generate page
@@ -342,7 +414,7 @@ bool blog_content(void* state, Request* request, Response* response) {
 			repsonse_content_headers(response, "html", content->length);
 		}
 
-		return true;
+		return CONTENT_READY;
 	}
 
 	// look for blog pages
@@ -350,19 +422,18 @@ bool blog_content(void* state, Request* request, Response* response) {
 		if (strcmp(request->target->path, blog->posts[i].path)==0) {
 			// check this is a GET or HEAD request
 			if (!method_allowed(request, response)) {
-				return true;
+				return CONTENT_READY;
 			}
 
 			TRACE("generate \"%s\" page", blog->posts[i].title);
 
 			// check modified date
-			check_post_date(&(blog->posts[i]));
 			mod_date = max_time_t(mod_date, blog->posts[i].mod_date);
 
 			if (request->if_modified_since>0 && request->if_modified_since>=mod_date) {
 				TRACE("not modified, use cached version");
 				response_status(response, 304);
-				return true;
+				return CONTENT_READY;
 			}
 			
 			// generate page
@@ -392,11 +463,11 @@ bool blog_content(void* state, Request* request, Response* response) {
 				repsonse_content_headers(response, "html", content->length);
 			}
 
-			return true;
+			return CONTENT_READY;
 		}
 	}
 
-	return false;
+	return CONTENT_NOT_FOUND;
 }
 
 #undef BLOG_DIR
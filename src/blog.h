@@ -4,6 +4,7 @@
 #include <stdbool.h>
 #include "request.h"
 #include "response.h"
+#include "content_generator.h"
 
 #define BLOG_MAX_PATH_LEN 256
 #define BLOG_MAX_DATE_LEN 20
@@ -29,15 +30,23 @@ struct post {
 
 typedef struct {
 	time_t mod_date;
+	size_t refs; // the generator's, and one for each page still being sent from this copy
 	struct html_fragment fragments[HF_COUNT];
 	size_t size;
 	size_t count;
 	struct post* posts;
 } Blog;
 
-Blog* blog_new();
-void blog_free(Blog* blog);
+// the generator's state, the blog is swapped for a new copy as soon as anything changes.
+// Pages still being sent keep the copy they started with
+typedef struct {
+	Blog* blog;
+	bool refreshing; // a worker is checking for changes
+} BlogState;
+
+BlogState* blog_state_new();
+void blog_state_free(BlogState* state);
 
-bool blog_content(void* state, Request* request, Response* Response);
+int blog_content(void* state, Request* request, Response* Response);
 
 #endif
\ No newline at end of file
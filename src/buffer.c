@@ -1,6 +1,12 @@
+#define _POSIX_C_SOURCE 200809L
+
 #include <string.h>
 #include <stdio.h>
 #include <stdarg.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
 
 #include "utils.h"
 #include "buffer.h"
@@ -89,24 +95,36 @@ void buf_append_buf(Buffer* target, Buffer* source) {
 	memcpy(target->data + target->length, source->data, len);
 	target->length += len;
 }
+// plain system calls, stdio would allocate for every file
 bool buf_append_file(Buffer* buf, const char* path) {
-	FILE *file = fopen(path, "rb");	
-	if (file == NULL) {
+	int file = open(path, O_RDONLY | O_CLOEXEC);
+	if (file < 0) {
 		return false;
 	}
 
-	fseek(file, 0, SEEK_END);
-	long length = ftell(file);
-	fseek(file, 0, SEEK_SET);
-
-	char* buf_ptr = buf_reserve(buf, length);
-	if (buf_ptr == NULL) {
+	struct stat attrib;
+	if (fstat(file, &attrib) != 0) {
+		close(file);
 		return false;
 	}
 
-	fread(buf_ptr, 1, length, file);
-	fclose(file);
+	long length = attrib.st_size;
+	char* buf_ptr = buf_reserve(buf, length);
+	long got = 0;
+	while (got < length) {
+		ssize_t n = read(file, buf_ptr + got, length - got);
+		if (n < 0 && errno == EINTR) {
+			continue;
+		}
+		if (n <= 0) {
+			break;
+		}
+		got += n;
+	}
+	close(file);
 
+	// in case it shrank
+	buf_advance_write(buf, got - length);
 	return true;
 }
 
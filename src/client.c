@@ -1,109 +1,664 @@
+#include <errno.h>
+#include <string.h>
+
 #include "console.h"
 #include "client.h"
+#include "server.h"
 #include "buffer.h"
 
 ClientState* client_state_new() {
 	ClientState* state = allocate(NULL, sizeof(*state));
-	state->request = request_new();
-	state->response = response_new();
+	state->mode = CLIENT_IDLE;
+	state->answered = 0;
+	state->closing = false;
+	state->proxied = false;
+	state->shed = false;
+	state->answering = false;
+	state->waiting = false;
+	state->abandoned = false;
+	state->generator = 0;
+	state->arena = arena_new(ARENA_DEFAULT_SIZE);
+	state->request = request_new(state->arena);
+	state->response = response_new(state->arena);
 	return state;
 }
+void client_state_reset(ClientState* state) {
+	state->mode = CLIENT_IDLE;
+	state->answered = 0;
+	state->closing = false;
+	state->proxied = false;
+	state->shed = false;
+	state->answering = false;
+	state->waiting = false;
+	state->abandoned = false;
+	state->generator = 0;
+	state->address[0] = '\0';
+	request_reset(state->request);
+	response_reset(state->response);
+	response_zerocopy(state->response, 0);
+	arena_reset(state->arena);
+}
 void client_state_free(ClientState* state) {
 	request_free(state->request);
 	response_free(state->response);
+	arena_free(state->arena);
 	free(state);
 }
 
-static bool send_response(struct pollfd* pfd, ClientState* state) {
-	Response* response = state->response;
+// change what the connection is doing and start the timeout for it
+static void set_mode(Sockets* sockets, int index, ClientState* state, unsigned short mode) {
+	state->mode = mode;
+
+	int timeout = 0;
+	switch (mode) {
+		case CLIENT_IDLE:
+			timeout = state->config->idle_timeout;
+			break;
+		case CLIENT_READ:
+			timeout = state->config->header_timeout;
+			break;
+		case CLIENT_WRITE:
+		case CLIENT_FLUSH:
+			timeout = state->config->write_timeout;
+			break;
+		case CLIENT_SKIP:
+			timeout = state->config->body_timeout;
+			break;
+	}
+	sockets_set_timeout(sockets, index, timeout > 0 ? timeout : -1);
+}
 
-	ssize_t sent = response_send(response, pfd->fd);
-	if (sent < 0) {
-		ERROR("send error for %s (%d)", state->address, pfd->fd);
+void client_load_init(ClientLoad* load, size_t spare) {
+	load->connections = 0;
+	load->requests = 0;
+	load->paused = false;
+	load->draining = false;
+
+	load->done = workers_done_new();
+	load->uris = NULL;
+	load->waiting = 0;
+
+	load->servers_size = 0;
+	load->servers_count = 0;
+	load->servers = NULL;
+
+	load->spare_size = spare > 0 ? spare : 1;
+	load->spare_count = 0;
+	load->spare = allocate(NULL, sizeof(*load->spare) * load->spare_size);
+	while (load->spare_count < spare) {
+		load->spare[load->spare_count++] = client_state_new();
+	}
+}
+void client_load_free(ClientLoad* load) {
+	for (size_t i=0; i<load->spare_count; i++) {
+		client_state_free(load->spare[i]);
+	}
+	free(load->spare);
+	free(load->servers);
+	workers_done_free(load->done);
+}
+
+// take a spare state, or make one if there are none
+static ClientState* get_state(ClientLoad* load) {
+	if (load->spare_count > 0) {
+		return load->spare[--load->spare_count];
+	}
+	return client_state_new();
+}
+
+// keep the state to use again, its buffers are already the right size
+static void put_state(ClientLoad* load, ClientState* state) {
+	client_state_reset(state);
+	if (load->spare_count == load->spare_size) {
+		load->spare_size *= 2;
+		load->spare = allocate(load->spare, sizeof(*load->spare) * load->spare_size);
+	}
+	load->spare[load->spare_count++] = state;
+}
+
+// count a request as being answered, unless there are too many already
+static bool admit_request(ClientState* state) {
+	const ClientConfig* config = state->config;
+	ClientLoad* load = state->load;
+
+	if (state->shed || (config->max_requests > 0 && load->requests >= config->max_requests)) {
 		return false;
 	}
-	if (response->stage != RESPONSE_DONE) {
-		pfd->events = POLLOUT;
+	load->requests++;
+	state->answering = true;
+	return true;
+}
+
+static void request_answered(ClientState* state) {
+	if (state->answering) {
+		state->load->requests--;
+		state->answering = false;
+	}
+}
+
+static void close_client(Sockets* sockets, int index, ClientState* state) {
+	const ClientConfig* config = state->config;
+	ClientLoad* load = state->load;
+
+	// anything the kernel is still sending from our memory is thrown away with the connection
+	if (response_pinned(state->response) && !set_reset_on_close(sockets->pollfds[index].fd)) {
+		ERROR("unable to reset connection from %s (%d)", state->address, sockets->pollfds[index].fd);
+	}
+	sockets_close(sockets, index);
+	request_answered(state);
+	load->connections--;
+
+	// the workers still have the request, it's put back when they're done
+	if (state->waiting) {
+		state->abandoned = true;
 	} else {
-		Request* request = state->request;
-		if (token_is(request->connection, "close")) {
+		put_state(load, state);
+	}
+
+	if (load->paused && (config->max_connections == 0 || load->connections < config->max_connections)) {
+		server_resume(sockets, load);
+	}
+}
+
+// the response is sent or batched, move on to anything pipelined after the request
+static void next_request(ClientState* state) {
+	request_answered(state);
+	state->answered++;
+	request_next(state->request);
+	arena_reset(state->arena);
+	request_parse(state->request);
+}
+
+// the connection is finished with once this response is sent
+static bool closes(ClientState* state) {
+	return state->closing || state->response->close || token_is(state->request->connection, "close");
+}
+
+static bool send_response(Sockets* sockets, int index, ClientState* state) {
+	int socket = sockets->pollfds[index].fd;
+	Response* response = state->response;
+
+	// keep sending until done or the socket is full, edge triggered backends only
+	// tell us when it has space again
+	bool progress = false;
+	while (response->stage != RESPONSE_DONE) {
+		ssize_t sent = response_send(response, sockets, index);
+		if (sent < 0) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK) {
+				if (progress || state->mode != CLIENT_WRITE) {
+					set_mode(sockets, index, state, CLIENT_WRITE);
+				}
+				sockets_set_events(sockets, index, POLLOUT);
+				return true;
+			}
+			ERROR("send error for %s (%d)", state->address, socket);
 			return false;
 		}
-		request_reset(request);
-		response_reset(response);
-		pfd->events = POLLIN;
+		progress = progress || sent > 0;
 	}
+
+	Request* request = state->request;
+	if (closes(state)) {
+		request_answered(state);
+		state->answered++;
+
+		// closing now would throw away what the kernel hasn't sent yet
+		if (response_pinned(response)) {
+			set_mode(sockets, index, state, CLIENT_FLUSH);
+			sockets_set_events(sockets, index, 0);
+			return true;
+		}
+		return false;
+	}
+	response_reset(response);
+
+	// the body wasn't wanted, but it has to be read to find the next request
+	if (!request->body_done) {
+		set_mode(sockets, index, state, CLIENT_SKIP);
+		sockets_set_events(sockets, index, POLLIN);
+		return true;
+	}
+	next_request(state);
+
+	// the header deadline for part of a pipelined request has already started
+	set_mode(sockets, index, state, request->buf->length > 0 && !request->complete ? CLIENT_READ : CLIENT_IDLE);
+	sockets_set_events(sockets, index, POLLIN);
 	return true;
 }
 
-static bool read_request(struct pollfd* pfd, ClientState* state) {
+// run the content generators from first on, false when one is waiting on blocking work.
+// A generator called again gets its work_arg back, the rest see none
+static bool run_generators(ClientState* state, size_t first) {
 	Request* request = state->request;
 	Response* response = state->response;
 
-	int recvied = request_recv(request, pfd->fd);
-	if (recvied <= 0) {
-		if (recvied < 0) {
-			ERROR("recv error from %s (%d)", state->address, pfd->fd);
-		} else {
-			LOG("connection from %s (%d) closed", state->address, pfd->fd);
+	// straight to the one that answered last time
+	long resolved = request->resolution.generator;
+	if (first == 0 && resolved > 0 && (size_t)resolved < state->content->count) {
+		first = resolved;
+	}
+
+	for (size_t i=first; i<state->content->count; i++) {
+		int result = state->content->generators[i](state->content->states[i], request, response);
+		if (result == CONTENT_PENDING) {
+			state->generator = i;
+			return false;
 		}
-		return false;
-	} else if (!request->complete) {
-		return true;
+		request->work = NULL;
+		request->work_arg = NULL;
+		if (result != CONTENT_NOT_FOUND) {
+			if (request->noted && request->uris != NULL) {
+				request->resolution.generator = i;
+				uri_cache_resolve(request->uris, request->raw_target, &request->resolution);
+			}
+			return true;
+		}
+
+		// any note was for that one
+		request->resolution.note_size = 0;
+		request->noted = false;
+	}
+
+	response_error(response, 404);
+	return true;
+}
+
+// hand blocking work to the workers, true if the connection now waits for them.  When they
+// are busy the work is done here and now
+static bool wait_for_work(Sockets* sockets, int index, ClientState* state) {
+	Request* request = state->request;
+	do {
+		state->task.work = request->work;
+		state->task.arg = request->work_arg;
+		state->task.owner = state;
+		state->task.done = state->load->done;
+		if (workers_submit(state->config->workers, &state->task)) {
+			TRACE("waiting on workers for %s (%d)", state->address, sockets->pollfds[index].fd);
+			state->waiting = true;
+			state->load->waiting++;
+			set_mode(sockets, index, state, CLIENT_WAIT);
+			sockets_set_events(sockets, index, 0);
+			return true;
+		}
+		request->work(request->work_arg);
+	} while (!run_generators(state, state->generator));
+	return false;
+}
+
+// false when waiting on blocking work
+static bool generate_response(int socket, ClientState* state) {
+	Request* request = state->request;
+	Response* response = state->response;
+
+	// there's no telling where the next request starts
+	if (request->lost) {
+		response_close(response);
+	}
+
+	if (request->error != 0) {
+		WARN("Request too large from %s (%d), answering %d", state->address, socket, request->error);
+		response_error(response, request->error);
+		if (token_is(request->connection, "close")) {
+			response_header(response, "Connection", "close");
+		}
+
+	} else if (request->method.length==0 || !request->target->valid || request->version.length==0) {
+		WARN("Bad request from %s (%d)", state->address, socket);
+		DEBUG_DETAIL("%.*s", request->start_line.length, request->start_line.start);
+		response_error(response, 400);
+
+	} else if (!token_is(request->version, "HTTP/1.0") && !token_is(request->version, "HTTP/1.1")) {
+		WARN("Unsupported HTTP version (%.*s) from %s (%d)", request->version.length, request->version.start, state->address, socket);
+		response_error(response, 505);
+
+	} else if (token_is(request->version, "HTTP/1.1") && request->headers[HEADER_HOST].length==0) {
+		WARN("No host header from %s (%d)", state->address, socket);
+		response_error(response, 400);
+
+	} else if (request->body_framing == BODY_INVALID) {
+		WARN("Bad body length from %s (%d)", state->address, socket);
+		response_error(response, 400);
+
+	} else if (request->body_framing == BODY_UNSUPPORTED) {
+		WARN("Unsupported transfer encoding from %s (%d)", state->address, socket);
+		response_error(response, 501);
+		
 	} else {
-		if (request->method.length==0 || !request->target->valid || request->version.length==0) {
-			WARN("Bad request from %s (%d)", state->address, pfd->fd);
-			DEBUG_DETAIL("%.*s", request->start_line.length, request->start_line.start);
-			response_error(response, 400);
-
-		} else if (!token_is(request->version, "HTTP/1.0") && !token_is(request->version, "HTTP/1.1")) {
-			WARN("Unsupported HTTP version (%.*s) from %s (%d)", request->version.length, request->version.start, state->address, pfd->fd);
-			response_error(response, 505);
-
-		} else if (token_is(request->version, "HTTP/1.1") && request->host.length==0) {
-			WARN("No host header from %s (%d)", state->address, pfd->fd);
-			response_error(response, 400);
-			
-		} else {
-			LOG("\"%.*s\" \"%s\" from %s (%d)", request->method.length, request->method.start, request->target->path, state->address, pfd->fd);
+		LOG("\"%.*s\" \"%s\" from %s (%d)", request->method.length, request->method.start, request->target->path, state->address, socket);
+		return run_generators(state, 0);
+	}
+	return true;
+}
+
+// still sending, or waiting to close
+static bool sending(ClientState* state) {
+	return state->mode == CLIENT_WRITE || state->mode == CLIENT_FLUSH;
+}
+
+// send the response, unless the next request is already here and it can go with that one's
+static bool respond(Sockets* sockets, int index, ClientState* state) {
+	if (!closes(state) && request_pipelined(state->request) && response_batch(state->response)) {
+		TRACE("holding response to %s (%d) for the next one", state->address, sockets->pollfds[index].fd);
+		next_request(state);
+		return true;
+	}
+	return send_response(sockets, index, state);
+}
+
+// recv into the request, 1 with more of it, 0 when there's nothing yet, -1 when the
+// connection is done for
+static int recv_request(Sockets* sockets, int index, ClientState* state) {
+	int socket = sockets->pollfds[index].fd;
+	ssize_t recvied = request_recv(state->request, sockets, index);
+	if (recvied < 0) {
+		if (errno == EAGAIN || errno == EWOULDBLOCK) {
+			return 0;
+		}
+		if (errno == EPROTO) {
+			WARN("invalid PROXY protocol header from %s (%d)", state->address, socket);
+			return -1;
+		}
+		ERROR("recv error from %s (%d)", state->address, socket);
+		return -1;
+	} else if (recvied == 0) {
+		LOG("connection from %s (%d) closed", state->address, socket);
+		return -1;
+	}
+	return 1;
+}
+
+// throw the body away a window at a time.  1 once it's all read, 0 to wait for more, -1
+// when the connection is done for
+static int skip_body(Sockets* sockets, int index, ClientState* state) {
+	Request* request = state->request;
+	for (;;) {
+		Token piece;
+		int found;
+		do {
+			found = request_body(request, &piece);
+		} while (found > 0);
+		if (found < 0) {
+			WARN("invalid chunked body from %s (%d)", state->address, sockets->pollfds[index].fd);
+			return -1;
+		}
+		if (request->body_done) {
+			return 1;
+		}
+
+		int recvied = recv_request(sockets, index, state);
+		if (recvied <= 0) {
+			return recvied;
+		}
+		// the body timeout is between pieces
+		set_mode(sockets, index, state, state->mode);
+	}
+}
+
+static bool read_request(Sockets* sockets, int index, ClientState* state) {
+	int socket = sockets->pollfds[index].fd;
+	Request* request = state->request;
+	Response* response = state->response;
+
+	// keep reading until there is nothing left, edge triggered backends won't tell us again.
+	// Pipelined requests already read are answered first
+	for (;;) {
+		if (!request->complete) {
+			int recvied = recv_request(sockets, index, state);
+			if (recvied <= 0) {
+				return recvied == 0;
+			}
+
+			// the proxy tells us who the client really is
+			if (state->proxied && !request->proxy) {
+				state->proxied = false;
+				if (request->proxy_address[0] != '\0') {
+					LOG("connection from %s (%d) is for %s", state->address, socket, request->proxy_address);
+					strcpy(state->address, request->proxy_address);
+				}
+			}
+
+			if (!request->complete) {
+				// the header deadline runs from the first byte
+				if (state->mode == CLIENT_IDLE) {
+					set_mode(sockets, index, state, CLIENT_READ);
+				}
+				continue;
+			}
+		}
 
-			bool ready = false;
-			for (size_t i=0; !ready && i<state->content->count; i++) {
-				ready = state->content->generators[i](state->content->states[i], request, response);
+		if (state->mode == CLIENT_SKIP) {
+			int read = skip_body(sockets, index, state);
+			if (read <= 0) {
+				return read == 0;
 			}
+			next_request(state);
+			set_mode(sockets, index, state, request->buf->length > 0 && !request->complete ? CLIENT_READ : CLIENT_IDLE);
+			continue;
+		}
 
-			if (!ready) {
-				response_error(response, 404);
+		if (admit_request(state)) {
+			if (!generate_response(socket, state) && wait_for_work(sockets, index, state)) {
+				return true;
 			}
-		}		
+			if (state->closing) {
+				response_header(response, "Connection", "close");
+			}
+		} else {
+			WARN("Overloaded, turning away \"%.*s\" from %s (%d)", request->method.length, request->method.start, state->address, socket);
+			response_preserialized(response, 503, state->config->unavailable);
+			state->closing = true;
+		}
 
-		// send
-		return send_response(pfd, state);
+		// send, or wait until there is room to
+		if (!respond(sockets, index, state)) {
+			return false;
+		}
+		if (sending(state)) {
+			return true;
+		}
 	}
 }
 
+static bool timed_out(Sockets* sockets, int index, ClientState* state) {
+	int socket = sockets->pollfds[index].fd;
+
+	switch (state->mode) {
+		case CLIENT_READ:
+			// tell slow clients why, then close
+			WARN("timed out reading request from %s (%d)", state->address, socket);
+			response_reset(state->response);
+			response_error(state->response, 408);
+			response_header(state->response, "Connection", "close");
+			state->closing = true;
+			return send_response(sockets, index, state);
+
+		case CLIENT_WRITE:
+			WARN("timed out sending response to %s (%d)", state->address, socket);
+			return false;
+
+		case CLIENT_SKIP:
+			WARN("timed out reading request body from %s (%d)", state->address, socket);
+			return false;
+
+		case CLIENT_FLUSH:
+			WARN("timed out finishing sending to %s (%d)", state->address, socket);
+			return false;
+
+		default:
+			LOG("connection from %s (%d) idle, closing", state->address, socket);
+			return false;
+	}
+}
+
+static void zerocopy_done(void* arg, uint32_t first, uint32_t last) {
+	response_zerocopy_done(arg, first, last);
+}
+
 void client_listener(Sockets* sockets, int index) {
 	struct pollfd* pfd = &sockets->pollfds[index];
 	ClientState* state = sockets->states[index];
 
+	// the kernel finishing with zerocopy sends is reported as an error
+	if ((pfd->revents & POLLERR) && response_pinned(state->response) && sockets_zerocopy_reap(sockets, index, zerocopy_done, state->response)) {
+		pfd->revents &= ~POLLERR;
+	}
+
 	bool flag = true;
-	if (pfd->revents & POLLHUP) {
+	if (pfd->revents & SOCKET_TIMEOUT) {
+		flag = timed_out(sockets, index, state);
+	} else if (pfd->revents & POLLHUP) {
 		LOG("connection from %s (%d) hung up", state->address, pfd->fd);
 		flag = false;
 	} else if (pfd->revents & (POLLERR | POLLNVAL)) {
 		ERROR("Socket error from %s (%d): %d", state->address, pfd->fd, pfd->revents);
 		flag = false;
-	} else {
+	} else if (state->mode == CLIENT_FLUSH) {
+		flag = response_pinned(state->response);
+	} else if (!state->waiting) {
 		if (pfd->revents & POLLIN) {
-			flag = read_request(pfd, state);
+			flag = read_request(sockets, index, state);
 		} else if (pfd->revents & POLLOUT) {
-			flag = send_response(pfd, state);
+			flag = send_response(sockets, index, state);
+
+			// answer or carry on reading requests pipelined behind that one
+			if (flag && !sending(state)) {
+				flag = read_request(sockets, index, state);
+			}
 		}
 	}
 
 	if (!flag) {
-		close(pfd->fd);
-		client_state_free(state);
-		sockets_rm(sockets, index);
+		close_client(sockets, index, state);
+	}
+}
+
+// the connection closed while the workers had its request.  The generator that was waiting
+// is called once more to take back what the work made, nothing else is tried for a client
+// that has gone.  More work it asks for goes back to the workers, never done here, and is
+// dropped when they're full.  True once the state can be put back
+static bool abandon_work(ClientState* state) {
+	Request* request = state->request;
+	size_t i = state->generator;
+	if (state->content->generators[i](state->content->states[i], request, state->response) != CONTENT_PENDING) {
+		return true;
+	}
+	state->task.work = request->work;
+	state->task.arg = request->work_arg;
+	if (!workers_submit(state->config->workers, &state->task)) {
+		TRACE("dropping work for a closed connection");
+		return true;
 	}
+	state->waiting = true;
+	state->load->waiting++;
+	return false;
+}
+
+// pick up where the generator left off and send the response, or put the state back if
+// the connection closed in the meantime
+static void work_done(Sockets* sockets, ClientState* state) {
+	ClientLoad* load = state->load;
+	state->waiting = false;
+	load->waiting--;
+
+	if (state->abandoned) {
+		if (abandon_work(state)) {
+			put_state(load, state);
+		}
+		return;
+	}
+
+	long index = sockets_lookup(sockets, state->id);
+	if (!run_generators(state, state->generator) && wait_for_work(sockets, index, state)) {
+		return;
+	}
+	if (state->closing) {
+		response_header(state->response, "Connection", "close");
+	}
+	if (!respond(sockets, index, state) || (!sending(state) && !read_request(sockets, index, state))) {
+		close_client(sockets, index, state);
+	}
+}
+
+void client_done_listener(Sockets* sockets, int index) {
+	ClientLoad* load = sockets->states[index];
+
+	WorkersTask* task = workers_done_take(load->done);
+	while (task != NULL) {
+		WorkersTask* next = task->next;
+		work_done(sockets, task->owner);
+		task = next;
+	}
+}
+
+// close connections kept alive between requests and let the rest finish what they are
+// doing, then close.  New connections get as long as they would to send their first request
+void client_drain(Sockets* sockets, ClientLoad* load) {
+	load->draining = true;
+	for (size_t i=0; i<sockets->high; i++) {
+		if (sockets->listeners[i] != client_listener) {
+			continue;
+		}
+		ClientState* state = sockets->states[i];
+		if (state->mode == CLIENT_IDLE && state->answered > 0) {
+			if (response_pinned(state->response)) {
+				set_mode(sockets, i, state, CLIENT_FLUSH);
+				sockets_set_events(sockets, i, 0);
+				continue;
+			}
+			LOG("closing idle connection from %s (%d)", state->address, sockets->pollfds[i].fd);
+			close_client(sockets, i, state);
+			continue;
+		}
+		state->closing = true;
+		if (state->mode == CLIENT_IDLE && state->config->header_timeout > 0) {
+			sockets_set_timeout(sockets, i, state->config->header_timeout);
+		}
+	}
+}
+
+// build the 503 sent when overloaded once, it's the same every time
+void client_config_prepare(ClientConfig* config) {
+	Arena* arena = arena_new(ARENA_DEFAULT_SIZE);
+	Response* response = response_new(arena);
+	response_error(response, 503);
+	if (config->retry_after > 0) {
+		char value[12];
+		snprintf(value, sizeof(value), "%d", config->retry_after);
+		response_header(response, "Retry-After", value);
+	}
+	response_header(response, "Connection", "close");
+
+	config->unavailable = response_serialize(response);
+	response_free(response);
+	arena_free(arena);
+}
+
+// proxied when the listener it came from expects a PROXY protocol header first
+ClientState* client_new(Sockets* sockets, int socket, bool proxied, ContentGenerators* content, const ClientConfig* config, ClientLoad* load) {
+	int index = sockets_add(sockets, socket, client_listener);
+
+	ClientState* state = get_state(load);
+	state->id = sockets_id(sockets, index);
+	state->content = content;
+	state->config = config;
+	state->load = load;
+	state->proxied = proxied;
+	state->request->proxy = proxied;
+	state->request->limits = &config->limits;
+	state->request->uris = load->uris;
+	sockets->states[index] = state;
+	if (config->zerocopy_min > 0 && sockets_zerocopy_enable(sockets, index)) {
+		response_zerocopy(state->response, config->zerocopy_min);
+	}
+
+	load->connections++;
+	if (load->draining) {
+		state->closing = true;
+	}
+	if (config->soft_connections > 0 && load->connections > config->soft_connections) {
+		state->shed = true;
+	}
+
+	set_mode(sockets, index, state, CLIENT_IDLE);
+	return state;
 }
\ No newline at end of file
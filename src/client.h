@@ -2,25 +2,101 @@
 #define TINN_CLIENT_H
 
 #include "utils.h"
+#include "buffer.h"
 #include "content_generator.h"
 #include "net.h"
 #include "request.h"
 #include "response.h"
+#include "workers.h"
+#include "arena.h"
 
-#define CLIENT_READ 1;
-#define CLIENT_WRITE 2;
+#define CLIENT_IDLE 0
+#define CLIENT_READ 1
+#define CLIENT_WRITE 2
+#define CLIENT_WAIT 3 // for blocking work on the workers, no timeout
+#define CLIENT_SKIP 4 // throwing away the body of a request that's been answered
+#define CLIENT_FLUSH 5 // closing once the kernel has finished with zerocopy sends
 
+// timeouts are in milliseconds, 0 for none.  Reading a request header has to finish within its
+// timeout of starting, body, idle and write timeouts restart with each bit of progress
 typedef struct {
+	int header_timeout;
+	int body_timeout;
+	int idle_timeout;
+	int write_timeout;
+
+	// admission limits, 0 for none.  Past max_connections server sockets stop accepting and
+	// connections wait in the kernel's backlog, past soft_connections new connections and past
+	// max_requests new requests are answered with a prepared 503
+	size_t max_connections;
+	size_t soft_connections;
+	size_t max_requests;
+	int retry_after; // seconds
+	int accept_batch; // connections accepted per wakeup
+	RequestLimits limits;
+	size_t zerocopy_min; // bodies this big are sent with MSG_ZEROCOPY, 0 for never
+	Workers* workers; // for content generators' blocking work, NULL to do it inline
+	Buffer* unavailable; // from client_config_prepare
+} ClientConfig;
+
+#define CLIENT_SPARE_START 16
+
+typedef struct client_state ClientState;
+
+// how busy a reactor is, shared by its server and client sockets, with spare client states
+// to save allocating them for every connection
+typedef struct {
+	size_t connections;
+	size_t requests; // being answered
+	bool paused; // server sockets not accepting
+	bool draining; // finishing what's open, then stopping
+
+	WorkersDone* done; // work finished by the workers
+	UriCache* uris; // NULL for none
+	size_t waiting; // connections waiting on the workers, including closed ones
+
+	size_t servers_size;
+	size_t servers_count;
+	size_t* servers; // server socket indexes
+
+	size_t spare_size;
+	size_t spare_count;
+	ClientState** spare;
+} ClientLoad;
+
+struct client_state {
 	ContentGenerators* content;
+	const ClientConfig* config;
+	ClientLoad* load;
+	SocketId id;
 	char address[INET6_ADDRSTRLEN];
 	unsigned short mode;
+	unsigned long answered; // requests answered on this connection
+	bool closing;
+	bool proxied; // still to read the PROXY protocol header
+	bool shed; // answer everything with 503
+	bool answering; // counted in load->requests
+	bool waiting; // on the workers, the state is kept until they're done
+	bool abandoned; // closed while waiting
+	size_t generator; // the one waiting
+	WorkersTask task;
+	Arena* arena; // reset after each request
 	Request* request;
 	Response* response;
-} ClientState;
+};
 
 ClientState* client_state_new();
+void client_state_reset(ClientState* state);
 void client_state_free(ClientState* state);
 
+void client_load_init(ClientLoad* load, size_t spare);
+void client_load_free(ClientLoad* load);
+
+void client_config_prepare(ClientConfig* config);
+
+ClientState* client_new(Sockets* sockets, int socket, bool proxied, ContentGenerators* content, const ClientConfig* config, ClientLoad* load);
 void client_listener(Sockets* sockets, int index);
+void client_done_listener(Sockets* sockets, int index);
+void client_drain(Sockets* sockets, ClientLoad* load);
 
 #endif
\ No newline at end of file
@@ -1,3 +1,5 @@
+#define _POSIX_C_SOURCE 200809L
+
 #include <stdarg.h>
 #include <time.h>
 #include <errno.h>
@@ -17,8 +19,9 @@ ConsoleLevel clevel = CL_DEBUG;
 
 static void print_time(FILE *stream) {
 	time_t seconds = time(NULL);
-	struct tm* gmt = gmtime(&seconds);
-	fprintf(stream, BLUE "%02d:%02d:%02d " RESET, gmt->tm_hour, gmt->tm_min, gmt->tm_sec);
+	struct tm gmt;
+	gmtime_r(&seconds, &gmt);
+	fprintf(stream, BLUE "%02d:%02d:%02d " RESET, gmt.tm_hour, gmt.tm_min, gmt.tm_sec);
 }
 
 static void print_prefix(FILE *stream, ConsoleLevel level) {
@@ -45,6 +48,11 @@ static void print_prefix(FILE *stream, ConsoleLevel level) {
 
 void console(FILE *stream, ConsoleLevel level, bool inc_time, bool inc_errno, const char* format, ...) {
 	if (level >= clevel) {
+		int saved_errno = errno;
+
+		// keep lines from different threads apart
+		flockfile(stream);
+
 		if (inc_time) {
 			print_time(stream);
 		} else {
@@ -57,10 +65,13 @@ void console(FILE *stream, ConsoleLevel level, bool inc_time, bool inc_errno, co
 		vfprintf(stream, format, args);
 		va_end(args);
 
-		if (inc_errno && errno != 0) {
-			fprintf(stream, " -> %s", strerror(errno));
+		if (inc_errno && saved_errno != 0) {
+			fprintf(stream, " -> %s", strerror(saved_errno));
 		}
 		fputs(RESET "\n", stream);
+
+		funlockfile(stream);
+		errno = saved_errno;
 	}
 }
 
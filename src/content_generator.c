@@ -1,3 +1,5 @@
+#include <string.h>
+
 #include "utils.h"
 #include "content_generator.h"
 
@@ -30,4 +32,42 @@ void content_generators_add(ContentGenerators* content, content_generator genera
 	content->states[content->count] = state;
 
 	content->count++;
-}
\ No newline at end of file
+}
+
+// run work on a worker thread, or inline if they are busy, and call the generator again
+int content_defer(Request* request, worker_fn work, void* arg) {
+	request->work = work;
+	request->work_arg = arg;
+	return CONTENT_PENDING;
+}
+
+// kept with the target in the URI cache, when there is one
+void content_note(Request* request, const void* note, size_t size) {
+	if (size <= URI_CACHE_NOTE_SIZE) {
+		memcpy(request->resolution.note, note, size);
+		request->resolution.note_size = size;
+		request->noted = true;
+	}
+}
+
+// the note left for this target last time, NULL if there isn't one
+const void* content_recall(Request* request, size_t size) {
+	return request->resolution.note_size == size ? request->resolution.note : NULL;
+}
+
+// answer with a body made a piece at a time by produce, see stream_fn.  HTTP/1.0 has no
+// chunks, the body runs to the end of the connection.  A HEAD request gets the headers alone
+int content_stream(Request* request, Response* response, stream_fn produce, void* arg, char* type) {
+	bool chunked = token_is(request->version, "HTTP/1.1");
+	if (token_is(request->method, "HEAD")) {
+		produce(arg, NULL);
+		response_stream(response, NULL, NULL, chunked, type);
+		return CONTENT_READY;
+	}
+
+	response_stream(response, produce, arg, chunked, type);
+	if (!chunked) {
+		response_close(response);
+	}
+	return CONTENT_READY;
+}
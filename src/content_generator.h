@@ -4,8 +4,23 @@
 #include <stdbool.h>
 #include "request.h"
 #include "response.h"
+#include "workers.h"
 
-typedef bool (*content_generator)(void* state, Request* request, Response* response);
+// a generator answers with one of these, true and false still mean ready and not found.
+// Blocking work is handed off with content_defer, once it's done the same generator is
+// called again with request->work_arg set and picks up where it left off.  It's called again
+// even if the client has gone, so it can let go of what the work made, but more work it
+// asks for then may be dropped.
+// A generator that answers can leave a note about how it found the content with content_note,
+// the next request for the same target goes straight to it and gets the note back from
+// content_recall, until the content changes.  So a generator that passes on a target has to
+// pass on it whatever the rest of the request says.  A body too big to make all at once can be
+// sent as it's made with content_stream
+#define CONTENT_NOT_FOUND 0
+#define CONTENT_READY 1
+#define CONTENT_PENDING 2
+
+typedef int (*content_generator)(void* state, Request* request, Response* response);
 
 typedef struct {
 	size_t size;
@@ -19,4 +34,11 @@ void content_generators_free(ContentGenerators* content);
 
 void content_generators_add(ContentGenerators* content, content_generator generator, void* state);
 
+int content_defer(Request* request, worker_fn work, void* arg);
+
+void content_note(Request* request, const void* note, size_t size);
+const void* content_recall(Request* request, size_t size);
+
+int content_stream(Request* request, Response* response, stream_fn produce, void* arg, char* type);
+
 #endif
\ No newline at end of file
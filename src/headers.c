@@ -0,0 +1,94 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <string.h>
+#include <strings.h>
+
+#include "headers.h"
+
+static const char* const names[HEADER_COUNT] = {
+	[HEADER_ACCEPT] = "Accept",
+	[HEADER_ACCEPT_ENCODING] = "Accept-Encoding",
+	[HEADER_ACCEPT_LANGUAGE] = "Accept-Language",
+	[HEADER_AUTHORIZATION] = "Authorization",
+	[HEADER_CACHE_CONTROL] = "Cache-Control",
+	[HEADER_CONNECTION] = "Connection",
+	[HEADER_CONTENT_LENGTH] = "Content-Length",
+	[HEADER_CONTENT_TYPE] = "Content-Type",
+	[HEADER_COOKIE] = "Cookie",
+	[HEADER_EXPECT] = "Expect",
+	[HEADER_FORWARDED] = "Forwarded",
+	[HEADER_HOST] = "Host",
+	[HEADER_IF_MATCH] = "If-Match",
+	[HEADER_IF_MODIFIED_SINCE] = "If-Modified-Since",
+	[HEADER_IF_NONE_MATCH] = "If-None-Match",
+	[HEADER_IF_RANGE] = "If-Range",
+	[HEADER_IF_UNMODIFIED_SINCE] = "If-Unmodified-Since",
+	[HEADER_ORIGIN] = "Origin",
+	[HEADER_PRAGMA] = "Pragma",
+	[HEADER_RANGE] = "Range",
+	[HEADER_REFERER] = "Referer",
+	[HEADER_TE] = "TE",
+	[HEADER_TRANSFER_ENCODING] = "Transfer-Encoding",
+	[HEADER_UPGRADE] = "Upgrade",
+	[HEADER_USER_AGENT] = "User-Agent",
+	[HEADER_X_FORWARDED_FOR] = "X-Forwarded-For",
+	[HEADER_X_FORWARDED_PROTO] = "X-Forwarded-Proto",
+	[HEADER_X_REAL_IP] = "X-Real-IP",
+};
+
+// the name's length plus its first and last characters, lower cased, times multipliers picked
+// so no two known names land in the same slot.  Adding a name means checking it doesn't collide,
+// and finding new multipliers if it does.  Slots hold the header plus one, 0 is empty
+#define HASH_SIZE 64
+#define HASH(length, first, last) (((length) + ((first) | 0x20) * 39 + ((last) | 0x20) * 21) & (HASH_SIZE - 1))
+
+static const unsigned char slots[HASH_SIZE] = {
+	[1] = HEADER_X_REAL_IP + 1,
+	[7] = HEADER_FORWARDED + 1,
+	[9] = HEADER_ACCEPT_ENCODING + 1,
+	[11] = HEADER_PRAGMA + 1,
+	[15] = HEADER_IF_MATCH + 1,
+	[16] = HEADER_IF_RANGE + 1,
+	[17] = HEADER_ACCEPT + 1,
+	[20] = HEADER_IF_NONE_MATCH + 1,
+	[25] = HEADER_IF_MODIFIED_SINCE + 1,
+	[26] = HEADER_AUTHORIZATION + 1,
+	[27] = HEADER_IF_UNMODIFIED_SINCE + 1,
+	[31] = HEADER_ACCEPT_LANGUAGE + 1,
+	[32] = HEADER_HOST + 1,
+	[33] = HEADER_USER_AGENT + 1,
+	[35] = HEADER_UPGRADE + 1,
+	[36] = HEADER_COOKIE + 1,
+	[37] = HEADER_CONNECTION + 1,
+	[42] = HEADER_CONTENT_TYPE + 1,
+	[43] = HEADER_CONTENT_LENGTH + 1,
+	[44] = HEADER_RANGE + 1,
+	[45] = HEADER_EXPECT + 1,
+	[48] = HEADER_TRANSFER_ENCODING + 1,
+	[49] = HEADER_X_FORWARDED_FOR + 1,
+	[52] = HEADER_X_FORWARDED_PROTO + 1,
+	[53] = HEADER_ORIGIN + 1,
+	[55] = HEADER_TE + 1,
+	[62] = HEADER_CACHE_CONTROL + 1,
+	[63] = HEADER_REFERER + 1,
+};
+
+// which known header a name is, ignoring case, or HEADER_UNKNOWN
+int header_lookup(const char* name, size_t length) {
+	if (length == 0) {
+		return HEADER_UNKNOWN;
+	}
+	int slot = slots[HASH(length, (unsigned char)name[0], (unsigned char)name[length-1])];
+	if (slot == 0) {
+		return HEADER_UNKNOWN;
+	}
+	const char* known = names[slot-1];
+	if (strlen(known) != length || strncasecmp(name, known, length) != 0) {
+		return HEADER_UNKNOWN;
+	}
+	return slot-1;
+}
+
+const char* header_name(KnownHeader header) {
+	return names[header];
+}
@@ -0,0 +1,45 @@
+#ifndef TINN_HEADERS_H
+#define TINN_HEADERS_H
+
+#include <stddef.h>
+
+// request headers known by name, each has a slot on the request.  Names are found with a
+// perfect hash so a header line costs one table lookup and one compare
+typedef enum {
+	HEADER_ACCEPT,
+	HEADER_ACCEPT_ENCODING,
+	HEADER_ACCEPT_LANGUAGE,
+	HEADER_AUTHORIZATION,
+	HEADER_CACHE_CONTROL,
+	HEADER_CONNECTION,
+	HEADER_CONTENT_LENGTH,
+	HEADER_CONTENT_TYPE,
+	HEADER_COOKIE,
+	HEADER_EXPECT,
+	HEADER_FORWARDED,
+	HEADER_HOST,
+	HEADER_IF_MATCH,
+	HEADER_IF_MODIFIED_SINCE,
+	HEADER_IF_NONE_MATCH,
+	HEADER_IF_RANGE,
+	HEADER_IF_UNMODIFIED_SINCE,
+	HEADER_ORIGIN,
+	HEADER_PRAGMA,
+	HEADER_RANGE,
+	HEADER_REFERER,
+	HEADER_TE,
+	HEADER_TRANSFER_ENCODING,
+	HEADER_UPGRADE,
+	HEADER_USER_AGENT,
+	HEADER_X_FORWARDED_FOR,
+	HEADER_X_FORWARDED_PROTO,
+	HEADER_X_REAL_IP,
+	HEADER_COUNT
+} KnownHeader;
+
+#define HEADER_UNKNOWN -1
+
+int header_lookup(const char* name, size_t length);
+const char* header_name(KnownHeader header);
+
+#endif
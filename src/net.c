@@ -1,13 +1,23 @@
-#define _POSIX_C_SOURCE 200809L
+#define _GNU_SOURCE
 
 #include <stdlib.h>
 #include <string.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#ifdef __linux__
+#include <sys/sendfile.h>
+#include <linux/errqueue.h>
+#endif
 
 #include "utils.h"
 #include "net.h"
 #include "console.h"
 
-int get_server_socket(char* port) {
+int get_server_socket(char* port, const ServerSocketOptions* options) {
 	int status;
 
 	struct addrinfo hints;
@@ -29,7 +39,7 @@ int get_server_socket(char* port) {
 
 	// get a socket and bind to it
 	for (address = addresses; address != NULL; address = address->ai_next) {
-		if ((sock = socket(address->ai_family, address->ai_socktype, address->ai_protocol)) < 0) {
+		if ((sock = socket(address->ai_family, address->ai_socktype | SOCK_CLOEXEC, address->ai_protocol)) < 0) {
 			continue;
 		}
 
@@ -37,6 +47,13 @@ int get_server_socket(char* port) {
 		int yes=1;
 		setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(int));
 
+		// share the port with other reactors, the kernel balances connections between them
+		if (options->reuse_port && setsockopt(sock, SOL_SOCKET, SO_REUSEPORT, &yes, sizeof(int)) != 0) {
+			ERROR("unable to set SO_REUSEPORT");
+			close(sock);
+			continue;
+		}
+
 		if (bind(sock, address->ai_addr, address->ai_addrlen) != 0) {
 			close(sock);
 			continue;
@@ -54,57 +71,508 @@ int get_server_socket(char* port) {
 
 	freeaddrinfo(addresses);
 
+	// tcp options, none of them are essential so just warn
+	int value;
+	if (options->nodelay) {
+		value = 1;
+		if (setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &value, sizeof(value)) != 0) {
+			WARN("unable to set TCP_NODELAY");
+		}
+	}
+#ifdef TCP_DEFER_ACCEPT
+	// only wake up for a connection once it has sent something
+	if (options->defer_accept > 0) {
+		value = options->defer_accept;
+		if (setsockopt(sock, IPPROTO_TCP, TCP_DEFER_ACCEPT, &value, sizeof(value)) != 0) {
+			WARN("unable to set TCP_DEFER_ACCEPT");
+		}
+	}
+#endif
+#ifdef TCP_FASTOPEN
+	// let clients send the request with their SYN
+	if (options->fastopen > 0) {
+		value = options->fastopen;
+		if (setsockopt(sock, IPPROTO_TCP, TCP_FASTOPEN, &value, sizeof(value)) != 0) {
+			WARN("unable to set TCP_FASTOPEN");
+		}
+	}
+#endif
+
 	// listen to socket
-	if (listen(sock, 10) != 0) {
+	if (listen(sock, options->backlog > 0 ? options->backlog : SOCKETS_DEFAULT_BACKLOG) != 0) {
 		ERROR("unable to listen to a socket");
+		close(sock);
+		return -1;
+	}
+
+	// edge triggered backends drain the accept queue, so never block
+	if (!set_non_blocking(sock)) {
+		ERROR("unable to make server socket non-blocking");
+		close(sock);
+		return -1;
+	}
+
+	return sock;
+}
+
+// a unix domain socket at path, for a proxy on the same machine.  A socket file left behind
+// by a server that's gone is replaced, one that's still answering is an error
+int get_unix_server_socket(const char* path, const ServerSocketOptions* options) {
+	struct sockaddr_un address;
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	if (strlen(path) >= sizeof(address.sun_path)) {
+		ERROR("unix socket path too long (%s)", path);
+		return -1;
+	}
+	strcpy(address.sun_path, path);
+
+	int sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (sock < 0) {
+		ERROR("unable to create unix socket");
+		return -1;
+	}
+
+	struct stat info;
+	if (lstat(path, &info) == 0 && S_ISSOCK(info.st_mode)) {
+		if (connect(sock, (struct sockaddr*)&address, sizeof(address)) == 0) {
+			ERROR("unix socket in use (%s)", path);
+			close(sock);
+			return -1;
+		}
+		unlink(path);
+	}
+
+	if (bind(sock, (struct sockaddr*)&address, sizeof(address)) != 0) {
+		ERROR("unable to bind to unix socket (%s)", path);
+		close(sock);
+		return -1;
+	}
+
+	if (listen(sock, options->backlog > 0 ? options->backlog : SOCKETS_DEFAULT_BACKLOG) != 0) {
+		ERROR("unable to listen to a socket");
+		close(sock);
+		return -1;
+	}
+
+	if (!set_non_blocking(sock)) {
+		ERROR("unable to make server socket non-blocking");
+		close(sock);
 		return -1;
 	}
 
 	return sock;
 }
 
-Sockets* sockets_new() {
+bool set_non_blocking(int socket) {
+	int flags = fcntl(socket, F_GETFL, 0);
+	if (flags < 0) {
+		return false;
+	}
+	return fcntl(socket, F_SETFL, flags | O_NONBLOCK) == 0;
+}
+
+// close with a reset, throwing away anything not yet sent
+bool set_reset_on_close(int socket) {
+	struct linger linger = {.l_onoff = 1, .l_linger = 0};
+	return setsockopt(socket, SOL_SOCKET, SO_LINGER, &linger, sizeof(linger)) == 0;
+}
+
+const SocketsBackend* sockets_backend(const char* name) {
+	if (name == NULL) {
+#ifdef __linux__
+		return &sockets_epoll_backend;
+#else
+		return &sockets_poll_backend;
+#endif
+	}
+	if (strcmp(name, sockets_poll_backend.name)==0) {
+		return &sockets_poll_backend;
+	}
+#ifdef __linux__
+	if (strcmp(name, sockets_epoll_backend.name)==0) {
+		return &sockets_epoll_backend;
+	}
+	if (strcmp(name, sockets_uring_backend.name)==0) {
+		return &sockets_uring_backend;
+	}
+#endif
+	return NULL;
+}
+
+struct socket_timer {
+	Timer timer;
+	size_t index;
+};
+
+static void grow(Sockets* list) {
+	list->size *= 2;
+
+	list->pollfds = allocate(list->pollfds, sizeof(*list->pollfds) * list->size);
+	list->listeners = allocate(list->listeners, sizeof(*list->listeners) * list->size);
+	list->states = allocate(list->states, sizeof(*list->states) * list->size);
+	list->timeouts = allocate(list->timeouts, sizeof(*list->timeouts) * list->size);
+	list->generations = allocate(list->generations, sizeof(*list->generations) * list->size);
+	list->free_slots = allocate(list->free_slots, sizeof(*list->free_slots) * list->size);
+}
+
+Sockets* sockets_new(const SocketsBackend* backend, int max_events) {
 	Sockets* list = allocate(NULL, sizeof(*list));
 	
 	list->size = 8;
 	list->count = 0;
+	list->high = 0;
 
 	list->pollfds = allocate(NULL, sizeof(*list->pollfds) * list->size);
 	list->listeners = allocate(NULL, sizeof(*list->listeners) * list->size);
 	list->states = allocate(NULL, sizeof(*list->states) * list->size);
+	list->timeouts = allocate(NULL, sizeof(*list->timeouts) * list->size);
+	list->generations = allocate(NULL, sizeof(*list->generations) * list->size);
+	list->free_slots = allocate(NULL, sizeof(*list->free_slots) * list->size);
+	list->free_count = 0;
+
+	list->again_size = 8;
+	list->again_count = 0;
+	list->again = allocate(NULL, sizeof(*list->again) * list->again_size);
+	list->again_events = allocate(NULL, sizeof(*list->again_events) * list->again_size);
+
+	timer_wheel_init(&list->timers, timer_now());
+
+	list->backend = backend;
+	list->max_events = max_events > 0 ? max_events : SOCKETS_DEFAULT_EVENTS;
+	list->backend_state = NULL;
+
+	// fall back to the default backend and then to poll, which always works
+	if (!list->backend->init(list)) {
+		const SocketsBackend* fallback = sockets_backend(NULL);
+		if (fallback == list->backend) {
+			fallback = &sockets_poll_backend;
+		}
+		WARN("unable to start %s backend, falling back to %s", list->backend->name, fallback->name);
+		list->backend = fallback;
+		if (!list->backend->init(list)) {
+			list->backend = &sockets_poll_backend;
+			list->backend->init(list);
+		}
+	}
+	TRACE("using %s backend", list->backend->name);
 
 	return list;
 }
 
-int sockets_add(Sockets* list, int new_socket, socket_listener new_listener) {
-	// do we need to expand the arrays
-	if (list->count == list->size) {
-		list->size *= 2;
+void sockets_free(Sockets* list) {
+	if (list != NULL) {
+		list->backend->free(list);
+		for (size_t i=0; i<list->high; i++) {
+			free(list->timeouts[i]);
+		}
+		free(list->pollfds);
+		free(list->listeners);
+		free(list->states);
+		free(list->timeouts);
+		free(list->generations);
+		free(list->free_slots);
+		free(list->again);
+		free(list->again_events);
+		free(list);
+	}
+}
+
+static bool in_use(Sockets* list, size_t index) {
+	return index < list->high && list->pollfds[index].fd >= 0;
+}
 
-		list->pollfds = allocate(list->pollfds, sizeof(*list->pollfds) * list->size);
-		list->listeners = allocate(list->listeners, sizeof(*list->listeners) * list->size);
-		list->states = allocate(list->states, sizeof(*list->states) * list->size);
+int sockets_add(Sockets* list, int new_socket, socket_listener new_listener) {
+	// re-use a free slot, or take a new one
+	size_t index;
+	if (list->free_count > 0) {
+		index = list->free_slots[--list->free_count];
+	} else {
+		if (list->high == list->size) {
+			grow(list);
+		}
+		index = list->high++;
+		list->timeouts[index] = NULL;
+		list->generations[index] = 0;
 	}
 
 	// add new socket
-	list->pollfds[list->count].fd = new_socket;
-	list->pollfds[list->count].events = POLLIN;
-	list->pollfds[list->count].revents = 0;
+	list->pollfds[index].fd = new_socket;
+	list->pollfds[index].events = POLLIN;
+	list->pollfds[index].revents = 0;
 
-	list->listeners[list->count] = new_listener;
+	list->listeners[index] = new_listener;
+	list->states[index] = NULL;
 
-	list->states[list->count] = NULL;
-
-	// update count
 	list->count++;
-	return list->count - 1;
+
+	list->backend->add(list, index);
+	return index;
+}
+
+void sockets_set_events(Sockets* list, size_t index, short events) {
+	if (in_use(list, index) && list->pollfds[index].events != events) {
+		list->pollfds[index].events = events;
+		list->backend->update(list, index);
+	}
+}
+
+// set how long, in milliseconds, before the socket's listener is called with SOCKET_TIMEOUT,
+// replacing any earlier timeout, negative to clear it
+void sockets_set_timeout(Sockets* list, size_t index, int timeout) {
+	if (!in_use(list, index)) {
+		return;
+	}
+
+	struct socket_timer* socket_timer = list->timeouts[index];
+	if (timeout < 0) {
+		if (socket_timer != NULL) {
+			timer_cancel(&list->timers, &socket_timer->timer);
+		}
+		return;
+	}
+
+	// slots keep their timer when re-used
+	if (socket_timer == NULL) {
+		socket_timer = allocate(NULL, sizeof(*socket_timer));
+		timer_init(&socket_timer->timer);
+		socket_timer->index = index;
+		list->timeouts[index] = socket_timer;
+	}
+	timer_add(&list->timers, &socket_timer->timer, timer_now(), timeout);
 }
 
+// call the socket's listener again next time round, with any of the events it still wants.
+// For listeners that stop part way through work to be fair to others, edge triggered
+// backends won't report the rest
+void sockets_again(Sockets* list, size_t index, short events) {
+	if (!in_use(list, index)) {
+		return;
+	}
+	if (list->again_count == list->again_size) {
+		list->again_size *= 2;
+		list->again = allocate(list->again, sizeof(*list->again) * list->again_size);
+		list->again_events = allocate(list->again_events, sizeof(*list->again_events) * list->again_size);
+	}
+	list->again[list->again_count] = sockets_id(list, index);
+	list->again_events[list->again_count] = events;
+	list->again_count++;
+}
+
+static void call_again(Sockets* list) {
+	// listeners can ask again while we go, they wait for the round after
+	size_t count = list->again_count;
+	for (size_t i=0; i<count; i++) {
+		long index = sockets_lookup(list, list->again[i]);
+		if (index < 0) {
+			continue;
+		}
+		struct pollfd* pfd = &list->pollfds[index];
+		pfd->revents = list->again_events[i] & pfd->events;
+		if (pfd->revents) {
+			list->listeners[index](list, index);
+		}
+	}
+	list->again_count -= count;
+	memmove(list->again, list->again + count, sizeof(*list->again) * list->again_count);
+	memmove(list->again_events, list->again_events + count, sizeof(*list->again_events) * list->again_count);
+}
+
+static void expire_timeout(Timer* timer, void* context) {
+	Sockets* list = context;
+	size_t index = ((struct socket_timer*)timer)->index;
+
+	list->pollfds[index].revents = SOCKET_TIMEOUT;
+	list->listeners[index](list, index);
+}
+
+// nothing else moves, so listeners can remove any socket, even while the backend is part
+// way through calling them
 void sockets_rm(Sockets* list, size_t index) {
-	if (index < list->count) {
-		list->pollfds[index] = list->pollfds[list->count-1];
-		list->listeners[index] = list->listeners[list->count-1];
-		list->states[index] = list->states[list->count-1];
+	if (in_use(list, index)) {
+		list->backend->remove(list, index);
+
+		if (list->timeouts[index] != NULL) {
+			timer_cancel(&list->timers, &list->timeouts[index]->timer);
+		}
+
+		list->pollfds[index].fd = -1;
+		list->pollfds[index].events = 0;
+		list->pollfds[index].revents = 0;
+		list->listeners[index] = NULL;
+		list->states[index] = NULL;
+		list->generations[index]++;
+
+		list->free_slots[list->free_count++] = index;
 		list->count--;
 	}
+}
+
+void sockets_close(Sockets* list, size_t index) {
+	if (in_use(list, index)) {
+		list->backend->close(list, index);
+		sockets_rm(list, index);
+	}
+}
+
+SocketId sockets_id(Sockets* list, size_t index) {
+	return ((SocketId)list->generations[index] << 32) | index;
+}
+
+// find a socket's index from its id, -1 when it has been removed
+long sockets_lookup(Sockets* list, SocketId id) {
+	size_t index = id & 0xffffffff;
+	if (!in_use(list, index) || list->generations[index] != (unsigned)(id >> 32)) {
+		return -1;
+	}
+	return index;
+}
+
+int sockets_dispatch(Sockets* list, int timeout) {
+	// wake up in time for the next socket timeout
+	int next = timer_wheel_next(&list->timers, timer_now());
+	if (next >= 0 && (timeout < 0 || next < timeout)) {
+		timeout = next;
+	}
+
+	// don't wait when there are listeners to call again
+	if (list->again_count > 0) {
+		timeout = 0;
+	}
+
+	int ready = list->backend->dispatch(list, timeout);
+	if (ready >= 0) {
+		call_again(list);
+		timer_wheel_advance(&list->timers, timer_now(), expire_timeout, list);
+	}
+	return ready;
+}
+
+int sockets_accept(Sockets* list, size_t index, struct sockaddr* address, socklen_t* address_size) {
+	return list->backend->accept(list, index, address, address_size);
+}
+
+ssize_t sockets_recv(Sockets* list, size_t index, void* buf, size_t len) {
+	return list->backend->recv(list, index, buf, len);
+}
+
+ssize_t sockets_send(Sockets* list, size_t index, const struct iovec* iov, int count) {
+	return list->backend->send(list, index, iov, count);
+}
+
+ssize_t sockets_sendfile(Sockets* list, size_t index, int fd, off_t* offset, size_t count) {
+	return list->backend->sendfile(list, index, fd, offset, count);
+}
+
+int sockets_plain_accept(Sockets* list, size_t index, struct sockaddr* address, socklen_t* address_size) {
+#ifdef __linux__
+	// one system call for a socket that's ready to use
+	return accept4(list->pollfds[index].fd, address, address_size, SOCK_NONBLOCK | SOCK_CLOEXEC);
+#else
+	int client_socket = accept(list->pollfds[index].fd, address, address_size);
+	if (client_socket >= 0 && !set_non_blocking(client_socket)) {
+		ERROR("unable to make socket %d non-blocking", client_socket);
+		close(client_socket);
+		errno = EAGAIN;
+		return -1;
+	}
+	return client_socket;
+#endif
+}
+
+ssize_t sockets_plain_recv(Sockets* list, size_t index, void* buf, size_t len) {
+	return recv(list->pollfds[index].fd, buf, len, 0);
+}
+
+// all the buffers in one go, what doesn't fit in the socket's buffer is offered again later
+ssize_t sockets_plain_send(Sockets* list, size_t index, const struct iovec* iov, int count) {
+	if (count == 0) {
+		return 0;
+	}
+	struct msghdr msg = {
+		.msg_iov = (struct iovec*)iov,
+		.msg_iovlen = count < SOCKETS_MAX_IOV ? count : SOCKETS_MAX_IOV
+	};
+	return sendmsg(list->pollfds[index].fd, &msg, MSG_DONTWAIT | MSG_NOSIGNAL);
+}
+
+// the kernel copies from the page cache to the socket, elsewhere a piece at a time through
+// a buffer on the stack
+ssize_t sockets_plain_sendfile(Sockets* list, size_t index, int fd, off_t* offset, size_t count) {
+#ifdef __linux__
+	return sendfile(list->pollfds[index].fd, fd, offset, count);
+#else
+	char buf[16384];
+	ssize_t got = pread(fd, buf, count < sizeof(buf) ? count : sizeof(buf), *offset);
+	if (got <= 0) {
+		return got;
+	}
+	ssize_t sent = send(list->pollfds[index].fd, buf, got, MSG_DONTWAIT | MSG_NOSIGNAL);
+	if (sent > 0) {
+		*offset += sent;
+	}
+	return sent;
+#endif
+}
+
+// false when the backend or socket can't, unix sockets for one
+bool sockets_zerocopy_enable(Sockets* list, size_t index) {
+#if defined(__linux__) && defined(SO_ZEROCOPY)
+	int one = 1;
+	return list->backend->zerocopy && setsockopt(list->pollfds[index].fd, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one)) == 0;
+#else
+	(void)list;
+	(void)index;
+	return false;
+#endif
+}
+
+// ENOBUFS when the kernel won't pin any more memory for the socket, send a copy instead
+ssize_t sockets_send_zerocopy(Sockets* list, size_t index, const void* buf, size_t len) {
+#if defined(__linux__) && defined(MSG_ZEROCOPY)
+	return send(list->pollfds[index].fd, buf, len, MSG_DONTWAIT | MSG_NOSIGNAL | MSG_ZEROCOPY);
+#else
+	(void)buf;
+	(void)len;
+	return sockets_plain_send(list, index, &(struct iovec){.iov_base = (void*)buf, .iov_len = len}, 1);
+#endif
+}
+
+// read the error queue, calling done for each range of finished sends.  False if there's a
+// real error on the socket as well
+bool sockets_zerocopy_reap(Sockets* list, size_t index, zerocopy_fn done, void* arg) {
+	int fd = list->pollfds[index].fd;
+#ifdef __linux__
+	for (;;) {
+		char control[128];
+		struct msghdr msg = {.msg_control = control, .msg_controllen = sizeof(control)};
+		if (recvmsg(fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0) {
+			if (errno != EAGAIN && errno != EWOULDBLOCK) {
+				return false;
+			}
+			break;
+		}
+		for (struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+			if (!((cmsg->cmsg_level == SOL_IP && cmsg->cmsg_type == IP_RECVERR) || (cmsg->cmsg_level == SOL_IPV6 && cmsg->cmsg_type == IPV6_RECVERR))) {
+				continue;
+			}
+			struct sock_extended_err err;
+			memcpy(&err, CMSG_DATA(cmsg), sizeof(err));
+			if (err.ee_origin == SO_EE_ORIGIN_ZEROCOPY && err.ee_errno == 0) {
+				done(arg, err.ee_info, err.ee_data);
+			}
+		}
+	}
+#else
+	(void)done;
+	(void)arg;
+#endif
+
+	int error = 0;
+	socklen_t size = sizeof(error);
+	return getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &size) == 0 && error == 0;
+}
+
+void sockets_plain_close(Sockets* list, size_t index) {
+	close(list->pollfds[index].fd);
 }
\ No newline at end of file
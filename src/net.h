@@ -1,28 +1,143 @@
 #ifndef NET_H
 #define NET_H
 
+#include <stdbool.h>
+#include <stdint.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <netdb.h>
 #include <arpa/inet.h>
 #include <poll.h>
 #include <unistd.h>
 
+#include "timer.h"
+
 typedef struct sockets_list Sockets;
 typedef void (*socket_listener)(Sockets* sockets, int index);
 
+// names a socket for as long as it's in the list, unlike its index which is re-used
+typedef uint64_t SocketId;
+
+// an event backend waits for activity on the sockets in a list and calls their listeners,
+// the list tells the backend when sockets are added, changed or removed.
+// Listeners do their I/O through the backend too.  Readiness backends make the system
+// calls there and then, completion backends may answer EAGAIN and finish the work in the
+// background, reporting POLLIN/POLLOUT when the listener should ask again.  A listener
+// told EAGAIN by send must offer the same data again and is then told how much was sent.
+// Send takes the whole response as a list of buffers, up to SOCKETS_MAX_IOV, so it goes out
+// in one system call, and in one segment when it's small.  Sendfile sends straight from a
+// file, from offset on, moving offset along by what was sent.  Readiness backends can also
+// send with MSG_ZEROCOPY, see sockets_send_zerocopy
+typedef struct {
+	const char* name;
+	bool zerocopy;
+	bool (*init)(Sockets* list);
+	void (*free)(Sockets* list);
+	void (*add)(Sockets* list, size_t index);
+	void (*update)(Sockets* list, size_t index);
+	void (*remove)(Sockets* list, size_t index);
+	int (*dispatch)(Sockets* list, int timeout);
+
+	int (*accept)(Sockets* list, size_t index, struct sockaddr* address, socklen_t* address_size);
+	ssize_t (*recv)(Sockets* list, size_t index, void* buf, size_t len);
+	ssize_t (*send)(Sockets* list, size_t index, const struct iovec* iov, int count);
+	ssize_t (*sendfile)(Sockets* list, size_t index, int fd, off_t* offset, size_t count);
+	void (*close)(Sockets* list, size_t index);
+} SocketsBackend;
+
+extern const SocketsBackend sockets_poll_backend;
+#ifdef __linux__
+extern const SocketsBackend sockets_epoll_backend;
+extern const SocketsBackend sockets_uring_backend;
+#endif
+
+// plain system call I/O shared by the readiness backends
+int sockets_plain_accept(Sockets* list, size_t index, struct sockaddr* address, socklen_t* address_size);
+ssize_t sockets_plain_recv(Sockets* list, size_t index, void* buf, size_t len);
+ssize_t sockets_plain_send(Sockets* list, size_t index, const struct iovec* iov, int count);
+ssize_t sockets_plain_sendfile(Sockets* list, size_t index, int fd, off_t* offset, size_t count);
+void sockets_plain_close(Sockets* list, size_t index);
+
+#define SOCKETS_MAX_IOV 8
+#define SOCKETS_DEFAULT_EVENTS 64
+#define SOCKETS_DEFAULT_BACKLOG 511
+
+// how a server socket listens, 0 leaves an option off
+typedef struct {
+	bool reuse_port;
+	int backlog;
+	int defer_accept; // seconds to wait for the first data before accepting
+	int fastopen; // queue length for TCP fast open
+	bool nodelay; // inherited by accepted sockets
+	bool proxy_protocol; // accepted connections start with a PROXY protocol header
+} ServerSocketOptions;
+
+// reported to a listener in revents when the timeout it set for its socket expires
+#define SOCKET_TIMEOUT 0x4000
+
+// a slab of sockets, each keeps its index until removed and then the slot is re-used.
+// Free slots below high have a negative fd, and each use of a slot has a new generation
 struct sockets_list {
 	size_t  size;
 	size_t  count;
+	size_t  high;
 	struct pollfd* pollfds;
 	socket_listener* listeners;
 	void** states;
+	struct socket_timer** timeouts;
+	unsigned* generations;
+
+	size_t* free_slots;
+	size_t free_count;
+
+	// listeners to call again next time round, see sockets_again
+	SocketId* again;
+	short* again_events;
+	size_t again_size;
+	size_t again_count;
+
+	TimerWheel timers;
+
+	const SocketsBackend* backend;
+	int max_events;
+	void* backend_state;
 };
 
-int get_server_socket(char* port);
+int get_server_socket(char* port, const ServerSocketOptions* options);
+int get_unix_server_socket(const char* path, const ServerSocketOptions* options);
+bool set_non_blocking(int socket);
+bool set_reset_on_close(int socket);
+
+const SocketsBackend* sockets_backend(const char* name);
+
+Sockets* sockets_new(const SocketsBackend* backend, int max_events);
+void sockets_free(Sockets* list);
 
-Sockets* sockets_new();
 int sockets_add(Sockets* list, int new_socket, socket_listener new_listener);
+void sockets_set_events(Sockets* list, size_t index, short events);
+void sockets_set_timeout(Sockets* list, size_t index, int timeout);
+void sockets_again(Sockets* list, size_t index, short events);
 void sockets_rm(Sockets* list, size_t index);
+void sockets_close(Sockets* list, size_t index);
+
+SocketId sockets_id(Sockets* list, size_t index);
+long sockets_lookup(Sockets* list, SocketId id);
+
+int sockets_dispatch(Sockets* list, int timeout);
+
+int sockets_accept(Sockets* list, size_t index, struct sockaddr* address, socklen_t* address_size);
+ssize_t sockets_recv(Sockets* list, size_t index, void* buf, size_t len);
+ssize_t sockets_send(Sockets* list, size_t index, const struct iovec* iov, int count);
+ssize_t sockets_sendfile(Sockets* list, size_t index, int fd, off_t* offset, size_t count);
+
+// the kernel sends straight from buf, which has to be left alone until it says it's finished.
+// Each send gets the next number from 0, and finished sends are reported as ranges of them on
+// the socket's error queue, which shows up as POLLERR
+typedef void (*zerocopy_fn)(void* arg, uint32_t first, uint32_t last);
+
+bool sockets_zerocopy_enable(Sockets* list, size_t index);
+ssize_t sockets_send_zerocopy(Sockets* list, size_t index, const void* buf, size_t len);
+bool sockets_zerocopy_reap(Sockets* list, size_t index, zerocopy_fn done, void* arg);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,126 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <string.h>
+#include <arpa/inet.h>
+
+#include "console.h"
+#include "proxy.h"
+
+static const char v1_signature[] = "PROXY ";
+static const char v2_signature[] = "\r\n\r\n\0\r\nQUIT\n";
+#define V1_SIGNATURE_LEN 6
+#define V2_SIGNATURE_LEN 12
+
+// check a signature as far as we have data for
+static int signature_match(const char* data, size_t length, const char* signature, size_t signature_len) {
+	size_t n = length < signature_len ? length : signature_len;
+	if (memcmp(data, signature, n) != 0) {
+		return PROXY_INVALID;
+	}
+	return n < signature_len ? PROXY_INCOMPLETE : 1;
+}
+
+// "PROXY TCP4 192.168.0.1 192.168.0.11 56324 443\r\n"
+static int parse_v1(const char* data, size_t length, char* address, size_t address_size) {
+	const char* end = memchr(data, '\n', length < PROXY_V1_MAX ? length : PROXY_V1_MAX);
+	if (end == NULL) {
+		return length < PROXY_V1_MAX ? PROXY_INCOMPLETE : PROXY_INVALID;
+	}
+	if (end == data || end[-1] != '\r') {
+		return PROXY_INVALID;
+	}
+	size_t header_len = end - data + 1;
+
+	char line[PROXY_V1_MAX + 1];
+	memcpy(line, data, header_len - 2);
+	line[header_len - 2] = '\0';
+
+	char* save;
+	strtok_r(line, " ", &save); // PROXY
+	char* protocol = strtok_r(NULL, " ", &save);
+	if (protocol == NULL) {
+		return PROXY_INVALID;
+	}
+	if (strcmp(protocol, "UNKNOWN") == 0) {
+		return header_len;
+	}
+
+	int family;
+	if (strcmp(protocol, "TCP4") == 0) {
+		family = AF_INET;
+	} else if (strcmp(protocol, "TCP6") == 0) {
+		family = AF_INET6;
+	} else {
+		return PROXY_INVALID;
+	}
+
+	char* source = strtok_r(NULL, " ", &save);
+	unsigned char binary[sizeof(struct in6_addr)];
+	if (source == NULL || inet_pton(family, source, binary) != 1) {
+		return PROXY_INVALID;
+	}
+	if (inet_ntop(family, binary, address, address_size) == NULL) {
+		return PROXY_INVALID;
+	}
+	return header_len;
+}
+
+// 12 byte signature, version and command, family, length, then addresses
+static int parse_v2(const unsigned char* data, size_t length, char* address, size_t address_size) {
+	if (length < PROXY_V2_MIN) {
+		return PROXY_INCOMPLETE;
+	}
+
+	int version = data[12] >> 4;
+	int command = data[12] & 0x0f;
+	int family = data[13] >> 4;
+	size_t header_len = PROXY_V2_MIN + ((size_t)data[14] << 8 | data[15]);
+	if (version != 2 || command > 1) {
+		return PROXY_INVALID;
+	}
+	if (length < header_len) {
+		return PROXY_INCOMPLETE;
+	}
+
+	// LOCAL connections are the proxy's own, and only IP addresses are any use
+	if (command == 0) {
+		return header_len;
+	}
+	if (family == 1 && header_len >= PROXY_V2_MIN + 12) {
+		if (inet_ntop(AF_INET, data + PROXY_V2_MIN, address, address_size) == NULL) {
+			return PROXY_INVALID;
+		}
+	} else if (family == 2 && header_len >= PROXY_V2_MIN + 36) {
+		if (inet_ntop(AF_INET6, data + PROXY_V2_MIN, address, address_size) == NULL) {
+			return PROXY_INVALID;
+		}
+	} else if (family == 1 || family == 2) {
+		return PROXY_INVALID;
+	}
+	return header_len;
+}
+
+// read a header from the start of data, returns its length, PROXY_INCOMPLETE when more data is
+// needed or PROXY_INVALID.  The client's address is written to address when the proxy knows it
+int proxy_parse(const char* data, size_t length, char* address, size_t address_size) {
+	if (length == 0) {
+		return PROXY_INCOMPLETE;
+	}
+
+	int match;
+	if (data[0] == 'P') {
+		if ((match = signature_match(data, length, v1_signature, V1_SIGNATURE_LEN)) <= 0) {
+			return match;
+		}
+		return parse_v1(data, length, address, address_size);
+	}
+	if (data[0] == '\r') {
+		if ((match = signature_match(data, length, v2_signature, V2_SIGNATURE_LEN)) <= 0) {
+			return match;
+		}
+		return parse_v2((const unsigned char*)data, length, address, address_size);
+	}
+
+	TRACE("no PROXY protocol header");
+	return PROXY_INVALID;
+}
@@ -0,0 +1,16 @@
+#ifndef TINN_PROXY_H
+#define TINN_PROXY_H
+
+#include <stddef.h>
+
+// the PROXY protocol, a load balancer in front of us sends a header before the request
+// saying who the client really is.  Both the text (v1) and binary (v2) versions are read
+#define PROXY_V1_MAX 107
+#define PROXY_V2_MIN 16
+
+#define PROXY_INCOMPLETE 0
+#define PROXY_INVALID -1
+
+int proxy_parse(const char* data, size_t length, char* address, size_t address_size);
+
+#endif
@@ -1,13 +1,29 @@
-#include <sys/socket.h>
+#define _POSIX_C_SOURCE 200809L
+
 #include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <errno.h>
 
 #include "request.h"
+#include "proxy.h"
 #include "utils.h"
 #include "console.h"
 
-Request* request_new() {
+// where chunked framing is up to
+#define CHUNK_SIZE 0
+#define CHUNK_DATA 1
+#define CHUNK_DATA_END 2
+#define CHUNK_TRAILER 3
+
+static const RequestLimits no_limits = {0};
+
+Request* request_new(Arena* arena) {
 	Request* request = allocate(NULL, sizeof(*request));
-	request->buf = buf_new(1024);
+	request->arena = arena;
+	request->limits = &no_limits;
+	request->uris = NULL;
+	request->buf = buf_new(REQUEST_BUFFER_SIZE);
 	request->target = NULL;
 	request_reset(request);
 	return request;	
@@ -16,9 +32,6 @@ Request* request_new() {
 void request_free(Request* request) {
 	if (request!=NULL) {
 		buf_free(request->buf);
-		if (request->target != NULL) {
-			uri_free(request->target);
-		}
 		free(request);
 	}
 }
@@ -31,96 +44,363 @@ Token default_header(char* value) {
 	return rv;
 }
 
-void request_reset(Request* request) {
+// forget the request, keeping the buffer
+static void clear(Request* request) {
 	request->complete = false;
-
-	buf_reset(request->buf);
+	request->error = 0;
+	request->lost = false;
 	request->content_start = -1;
+	request->header_scanned = 0;
 
 	request->method.length = 0;
-	if (request->target != NULL) {
-		uri_free(request->target);
-		request->target = NULL;
-	}
+	request->target = NULL;
 	request->version.length = 0;
 
-	request->host = default_header("");
+	memset(request->headers, 0, sizeof(request->headers));
+	request->others_count = 0;
 	request->connection = default_header("");
 	request->if_modified_since = 0;
+
+	request->body_framing = BODY_NONE;
+	request->body_done = true;
+	request->chunk_state = CHUNK_SIZE;
+	request->body_left = 0;
+	request->body_piece = 0;
+
+	request->resolution.generator = -1;
+	request->resolution.note_size = 0;
+	request->noted = false;
+
+	request->work = NULL;
+	request->work_arg = NULL;
+}
+
+// ready for a new connection, a buffer a big header grew goes back to the usual size
+void request_reset(Request* request) {
+	request->proxy = false;
+	request->proxy_address[0] = '\0';
+	if (request->buf->size > REQUEST_BUFFER_SIZE) {
+		buf_free(request->buf);
+		request->buf = buf_new(REQUEST_BUFFER_SIZE);
+	} else {
+		buf_reset(request->buf);
+	}
+	clear(request);
+}
+
+// done with this request and its body, anything after it is the start of the next one.  Tokens
+// in the buffer and anything in the arena are gone, call request_parse once the arena is reset
+void request_next(Request* request) {
+	if (request->complete) {
+		buf_consume(request->buf, request->content_start + request->body_piece);
+	} else {
+		buf_reset(request->buf);
+	}
+	clear(request);
+}
+
+// is there another whole header after this request, a client pipelining requests
+bool request_pipelined(Request* request) {
+	Buffer* buf = request->buf;
+	return request->complete && request->body_done && scan_header_end(buf->data + request->content_start, 0, buf->length - request->content_start) >= 0;
 }
 
-static int find_content(Buffer* buf) {
-	for (int i=3; i<buf->length; i++) {
-		if (buf->data[i-3]=='\r' && buf->data[i-2]=='\n' && buf->data[i-1]=='\r' && buf->data[i]=='\n') {
-			return i+1;
+// Content-Length, digits only, -2 if it's anything else
+static long long parse_length(Token value) {
+	if (value.length == 0 || value.length > 18) {
+		return -2;
+	}
+	long long length = 0;
+	for (size_t i=0; i<value.length; i++) {
+		if (!isdigit((unsigned char)value.start[i])) {
+			return -2;
 		}
+		length = length*10 + (value.start[i] - '0');
 	}
-	return -1;
+	return length;
 }
 
-ssize_t request_recv(Request* request, int socket) {
-	int recvied = recv(socket, buf_write_ptr(request->buf), buf_write_max(request->buf), 0);
+// hex digits, maybe followed by extensions which are ignored, -1 if it isn't a size
+static long long chunk_size(const char* line, long length) {
+	long long size = 0;
+	long i = 0;
+	for (; i<length && i<15 && isxdigit((unsigned char)line[i]); i++) {
+		char c = line[i];
+		size = size*16 + (c <= '9' ? c - '0' : (c | 0x20) - 'a' + 10);
+	}
+	if (i == 0 || (i < length && line[i] != ';' && line[i] != ' ' && line[i] != '\t')) {
+		return -1;
+	}
+	return size;
+}
+
+// drop n bytes from the front of the body window
+static void cut(Request* request, long n) {
+	Buffer* buf = request->buf;
+	if (n > 0) {
+		char* window = buf->data + request->content_start;
+		memmove(window, window + n, buf->length - request->content_start - n);
+		buf->length -= n;
+	}
+}
+
+// give up on a request the limits don't allow, there's no telling where it ends so the
+// connection is closed after answering
+static void too_large(Request* request, int error) {
+	request->error = error;
+	request->complete = true;
+	request->content_start = request->buf->length;
+	request->lost = true;
+}
+
+// carry on from where the last search got to, less 3 bytes in case the end was split
+static int find_content(Request* request) {
+	Buffer* buf = request->buf;
+	long found = scan_header_end(buf->data, request->header_scanned - 3, buf->length);
+	request->header_scanned = buf->length;
+	return found;
+}
+
+ssize_t request_recv(Request* request, Sockets* sockets, size_t index) {
+	ssize_t recvied = sockets_recv(sockets, index, buf_write_ptr(request->buf), buf_write_max(request->buf));
 	if (recvied > 0) {
-		TRACE("recived: %d", recvied);
+		TRACE("recived: %ld", recvied);
 
 		// update buffer
 		buf_advance_write(request->buf, recvied);
 
-		// check for content start
+		if (!request_parse(request)) {
+			return -1;
+		}
+	}
+	return recvied;
+}
+
+// read what has arrived so far, false with errno set if it's no good
+bool request_parse(Request* request) {
+	// take the PROXY protocol header off the front
+	if (request->proxy) {
+		int len = proxy_parse(request->buf->data, request->buf->length, request->proxy_address, INET6_ADDRSTRLEN);
+		if (len == PROXY_INVALID) {
+			errno = EPROTO;
+			return false;
+		}
+		if (len == PROXY_INCOMPLETE) {
+			if (buf_write_max(request->buf) < 128) {
+				buf_grow(request->buf);
+			}
+			return true;
+		}
+		buf_consume(request->buf, len);
+		request->proxy = false;
+	}
+
+	// check for content start
+	if (request->content_start < 0) {
+		request->content_start = find_content(request);
+		size_t max_header = request->limits->max_header;
+
 		if (request->content_start < 0) {
-			request->content_start = find_content(request->buf);
+			if (max_header > 0 && (size_t)request->buf->length >= max_header) {
+				TRACE("request header too large");
+				too_large(request, 431);
+			} else if (buf_write_max(request->buf) < 128) {
+				buf_grow(request->buf);
+			}
+		} else if (max_header > 0 && (size_t)request->content_start > max_header) {
+			TRACE("request header too large");
+			too_large(request, 431);
+		} else {
+			TRACE("header complete");
+
+			// read header
+			Scanner scanner = scanner_new(request->buf->data, request->content_start);
 
-			if (request->content_start < 0) {
-				if (buf_write_max(request->buf) < 128) {
-					buf_grow(request->buf);
+			// start line
+			request->start_line = scan_delimited(&scanner, &scan_crlf);
+			Scanner start_scanner = scanner_new(request->start_line.start, request->start_line.length);
+			request->method = scan_delimited(&start_scanner, &scan_space);
+			Token target = scan_delimited(&start_scanner, &scan_space);
+			if (request->limits->max_uri > 0 && target.length > request->limits->max_uri) {
+				// no need to copy it, it's going to be turned down
+				request->error = 414;
+				target.length = 0;
+			}
+			request->raw_target = target;
+			request->target = NULL;
+			if (request->uris != NULL) {
+				request->target = uri_cache_get(request->uris, request->arena, target, &request->resolution);
+			}
+			if (request->target == NULL) {
+				request->target = uri_new(request->arena, target);
+				if (request->uris != NULL && request->target->valid && request->error == 0) {
+					uri_cache_put(request->uris, target, request->target);
 				}
-			} else {
-				TRACE("header complete");
-
-				// read header
-				Scanner scanner = scanner_new(request->buf->data, request->content_start);
-
-				// start line
-				request->start_line = scan_token(&scanner, "\r\n");
-				Scanner start_scanner = scanner_new(request->start_line.start, request->start_line.length);
-				request->method = scan_token(&start_scanner, " ");
-				request->target = uri_new(scan_token(&start_scanner, " "));
-				request->version = scan_token(&start_scanner, "");
-
-				TRACE_DETAIL("%.*s %s %.*s", request->method.length, request->method.start, request->target->path, request->version.length, request->version.start);
-
-				// other headers
-				Token line;
-				while ((line = scan_token(&scanner, "\r\n")).length>0) {
-					Scanner header_scanner = scanner_new(line.start, line.length);
-					Token name = scan_token(&header_scanner, ": \t");
-					Token value = scan_token(&header_scanner, "");
-
-					TRACE_DETAIL("%.*s: %.*s", name.length, name.start, value.length, value.start);
-					if (token_is(name, "Host")) {
-						request->host = value;
-					} else if (token_is(name, "Connection")) {
-						request->connection = value;
-					} else if (token_is(name, "If-Modified-Since")) {
-						request->if_modified_since = from_imf_date(value.start, value.length);
-					}
+			}
+			request->version = scan_delimited(&start_scanner, &scan_rest);
+
+			TRACE_DETAIL("%.*s %s %.*s", request->method.length, request->method.start, request->target->path, request->version.length, request->version.start);
+
+			// other headers, -1 for no Content-Length and -2 for one that's no good
+			long long content_length = -1;
+			size_t count = 0;
+			Token line;
+			while ((line = scan_delimited(&scanner, &scan_crlf)).length>0) {
+				if (request->limits->max_headers > 0 && ++count > request->limits->max_headers) {
+					TRACE("too many request headers");
+					too_large(request, 431);
+					return true;
 				}
 
-				if (request->connection.length==0) {
-					if (token_is(request->version, "HTTP/1.0")) {
-						request->connection = default_header("close");
-					} else {
-						request->connection = default_header("keep-alive");
-					}
+				Scanner header_scanner = scanner_new(line.start, line.length);
+				Token name = scan_delimited(&header_scanner, &scan_header_name);
+				Token value = scan_delimited(&header_scanner, &scan_rest);
+
+				TRACE_DETAIL("%.*s: %.*s", name.length, name.start, value.length, value.start);
+				int header = header_lookup(name.start, name.length);
+				if (header == HEADER_CONTENT_LENGTH) {
+					long long length = parse_length(value);
+					content_length = length < 0 || (content_length != -1 && content_length != length) ? -2 : length;
 				}
+				if (header != HEADER_UNKNOWN) {
+					request->headers[header] = value;
+				} else if (request->others_count < REQUEST_OTHER_HEADERS) {
+					request->others[request->others_count].name = name;
+					request->others[request->others_count].value = value;
+					request->others_count++;
+				}
+			}
 
-				// complete?
-				// TODO: for post/patch/put there would be a content body to read....
-				request->complete = true;
+			request->connection = request->headers[HEADER_CONNECTION];
+			Token if_modified_since = request->headers[HEADER_IF_MODIFIED_SINCE];
+			if (if_modified_since.length > 0) {
+				request->if_modified_since = from_imf_date(if_modified_since.start, if_modified_since.length);
 			}
-		} else {
-			// TODO: read content
-		}		
+
+			// a length and a transfer coding together is how requests get smuggled
+			Token transfer_encoding = request->headers[HEADER_TRANSFER_ENCODING];
+			if (transfer_encoding.length > 0) {
+				if (content_length != -1) {
+					request->body_framing = BODY_INVALID;
+				} else if (token_is(transfer_encoding, "chunked")) {
+					request->body_framing = BODY_CHUNKED;
+				} else {
+					request->body_framing = BODY_UNSUPPORTED;
+				}
+			} else if (content_length == -2) {
+				request->body_framing = BODY_INVALID;
+			} else if (content_length > 0) {
+				request->body_framing = BODY_LENGTH;
+				request->body_left = content_length;
+			}
+			request->body_done = request->body_framing != BODY_LENGTH && request->body_framing != BODY_CHUNKED;
+
+			if (request->connection.length==0) {
+				if (token_is(request->version, "HTTP/1.0")) {
+					request->connection = default_header("close");
+				} else {
+					request->connection = default_header("keep-alive");
+				}
+			}
+
+			// there's no telling where the next request starts
+			if (request->body_framing == BODY_INVALID || request->body_framing == BODY_UNSUPPORTED) {
+				request->lost = true;
+			}
+
+			request->complete = true;
+		}
 	}
-	return recvied;
+	return true;
+}
+
+// any header by name, ignoring case, empty if it wasn't sent
+Token request_header(Request* request, const char* name) {
+	size_t length = strlen(name);
+	int header = header_lookup(name, length);
+	if (header != HEADER_UNKNOWN) {
+		return request->headers[header];
+	}
+	for (size_t i=0; i<request->others_count; i++) {
+		Token other = request->others[i].name;
+		if (other.length == length && strncasecmp(other.start, name, length) == 0) {
+			return request->others[i].value;
+		}
+	}
+	return default_header("");
+}
+
+// the next piece of the body, left in the buffer until the next call.  1 with a piece, 0 when
+// the body is done or more has to be read first, -1 if the chunked framing is no good
+int request_body(Request* request, Token* piece) {
+	Buffer* buf = request->buf;
+	cut(request, request->body_piece);
+	request->body_piece = 0;
+
+	while (!request->body_done) {
+		char* window = buf->data + request->content_start;
+		long available = buf->length - request->content_start;
+
+		if (request->body_framing == BODY_LENGTH || request->chunk_state == CHUNK_DATA) {
+			if (available == 0) {
+				break;
+			}
+			long n = available < request->body_left ? available : request->body_left;
+			request->body_left -= n;
+			if (request->body_left == 0) {
+				if (request->body_framing == BODY_LENGTH) {
+					request->body_done = true;
+				} else {
+					request->chunk_state = CHUNK_DATA_END;
+				}
+			}
+			piece->start = window;
+			piece->length = n;
+			request->body_piece = n;
+			return 1;
+		}
+
+		// chunk sizes, the end of the data and trailers are all lines
+		long search = available < REQUEST_CHUNK_LINE_MAX ? available : REQUEST_CHUNK_LINE_MAX;
+		char* end = memchr(window, '\n', search);
+		if (end == NULL) {
+			if (available >= REQUEST_CHUNK_LINE_MAX) {
+				return -1;
+			}
+			break;
+		}
+		long line_len = end - window + 1;
+		if (line_len < 2 || end[-1] != '\r') {
+			return -1;
+		}
+
+		switch (request->chunk_state) {
+			case CHUNK_SIZE:
+				request->body_left = chunk_size(window, line_len - 2);
+				if (request->body_left < 0) {
+					return -1;
+				}
+				request->chunk_state = request->body_left > 0 ? CHUNK_DATA : CHUNK_TRAILER;
+				break;
+
+			case CHUNK_DATA_END:
+				if (line_len != 2) {
+					return -1;
+				}
+				request->chunk_state = CHUNK_SIZE;
+				break;
+
+			case CHUNK_TRAILER:
+				// trailers aren't used, a blank line ends them
+				request->body_done = line_len == 2;
+				break;
+		}
+		cut(request, line_len);
+	}
+
+	// room to read more into
+	while (!request->body_done && buf_write_max(buf) < REQUEST_BODY_WINDOW) {
+		buf_grow(buf);
+	}
+	return 0;
 }
\ No newline at end of file
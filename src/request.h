@@ -5,30 +5,101 @@
 #include "buffer.h"
 #include "scanner.h"
 #include "uri.h"
+#include "net.h"
+#include "arena.h"
+#include "headers.h"
+#include "uri_cache.h"
 #include <time.h>
 #include <sys/types.h>
+#include <arpa/inet.h>
+
+// how the body after the header is framed.  Bodies are read a window at a time, the window
+// being the buffer past the header, at least REQUEST_BODY_WINDOW bytes of it
+#define BODY_NONE 0
+#define BODY_LENGTH 1
+#define BODY_CHUNKED 2
+#define BODY_INVALID 3 // framing headers that can't be trusted
+#define BODY_UNSUPPORTED 4 // a transfer coding other than chunked
+
+#define REQUEST_BODY_WINDOW 4096
+#define REQUEST_CHUNK_LINE_MAX 1024
+
+// the request buffer starts this big, and goes back to it for each connection
+#define REQUEST_BUFFER_SIZE 1024
+
+// limits on what a client can send, 0 for none.  Past them requests are answered with
+// request->error, 431 for the header or 414 for the target
+typedef struct {
+	size_t max_header; // bytes from the start line to the blank line
+	size_t max_headers; // header lines
+	size_t max_uri;
+} RequestLimits;
+
+// headers that aren't known by name, any past this many are dropped
+#define REQUEST_OTHER_HEADERS 16
+
+typedef struct {
+	Token name;
+	Token value;
+} HeaderField;
 
 typedef struct {
 	bool complete;
+	int error; // status to answer with when the request is more than the limits allow
+	bool lost; // where the request ends isn't known, the connection closes after answering
+	Arena* arena; // for the target and anything else that lasts as long as the request
+	const RequestLimits* limits;
+	UriCache* uris; // NULL to parse every target
+
+	// a PROXY protocol header comes before the request, cleared once read.  The client's
+	// address is left in proxy_address, empty if the proxy didn't say
+	bool proxy;
+	char proxy_address[INET6_ADDRSTRLEN];
 
 	Buffer* buf;
 	int content_start;
+	long header_scanned; // how far the search for the end of the header got
 
 	Token start_line;
 	Token method;
+	Token raw_target;
 	URI* target;
 	Token version;
 
-	Token host;
-	Token connection;
+	// known headers by KnownHeader, empty when not sent, and the rest in the order they came
+	Token headers[HEADER_COUNT];
+	size_t others_count;
+	HeaderField others[REQUEST_OTHER_HEADERS];
+
+	Token connection; // defaults to what the version implies
 	time_t if_modified_since;
+
+	// the body, see request_body.  body_left is what's left of it, or of the current chunk
+	int body_framing;
+	bool body_done;
+	int chunk_state;
+	long long body_left;
+	long body_piece; // handed out last time, dropped next time
+
+	// blocking work a content generator is waiting on, see content_defer
+	void (*work)(void* arg);
+	void* work_arg;
+
+	// what answered the target last time, from the URI cache, see content_note
+	UriResolution resolution;
+	bool noted; // this time
 } Request;
 
-Request* request_new();
+Request* request_new(Arena* arena);
 void request_free(Request* request);
 
 void request_reset(Request* request);
+void request_next(Request* request);
+bool request_pipelined(Request* request);
 
-ssize_t request_recv(Request* request, int socket);
+ssize_t request_recv(Request* request, Sockets* sockets, size_t index);
+bool request_parse(Request* request);
+Token request_header(Request* request, const char* name);
+int request_body(Request* request, Token* piece);
 
 #endif
\ No newline at end of file
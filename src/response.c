@@ -1,5 +1,5 @@
 #include <string.h>
-#include <sys/socket.h>
+#include <errno.h>
 
 #include "response.h"
 #include "utils.h"
@@ -9,9 +9,12 @@
 #define RC_HEADERS	1
 #define RC_INTERNAL	2
 #define RC_EXTERNAL	3
+#define RC_FILE		4
+#define RC_STREAM	5
 
-Response* response_new() {
+Response* response_new(Arena* arena) {
 	Response* response = allocate(NULL, sizeof(*response));
+	response->arena = arena;
 
 	response->status_code = 500;
 
@@ -21,45 +24,88 @@ Response* response_new() {
 	response->header_values = allocate(NULL, sizeof(*response->header_values) * response->headers_size);
 
 	response->content_source = RC_NONE;
+	response->body = buf_new(1024);
+	response->file = -1;
+	response->produce = NULL;
 
 	response->headers = buf_new(1024);
 	response->stage = RESPONSE_PREP;
+	response->close = false;
+
+	response->batch = buf_new(1024);
+
+	response->zerocopy_min = 0;
+	response->zerocopy_next = 0;
+	response->pinned_size = 0;
+	response->pinned_count = 0;
+	response->pinned = NULL;
+	response->spare = NULL;
 
 	return response;	
 }
 
-void response_reset(Response* response) {
-	response->status_code = 500;
+// let go of a file or stream from the last content set
+static void release_content(Response* response) {
+	if (response->file >= 0) {
+		close(response->file);
+		response->file = -1;
+	}
+	if (response->produce != NULL) {
+		stream_fn produce = response->produce;
+		response->produce = NULL;
+		produce(response->produce_arg, NULL);
+	}
+}
 
-	for (size_t i=0; i<response->headers_count; i++) {
-		free(response->header_names[i]);
-		free(response->header_values[i]);
+// leave a body the kernel is still sending from and start another, false if it isn't
+static bool unpin_body(Response* response) {
+	if (response->pinned_count > 0 && response->pinned[response->pinned_count-1].buf == response->body) {
+		response->body = response->spare != NULL ? response->spare : buf_new(1024);
+		response->spare = NULL;
+		return true;
 	}
+	return false;
+}
+
+// ready for the next response, keeping any batch
+static void clear(Response* response) {
+	response->status_code = 500;
 	response->headers_count = 0;
+	response->content_source = RC_NONE;
+	release_content(response);
 
-	if (response->content_source == RC_INTERNAL) {
-		buf_free(response->content);
+	// or a big one
+	if (!unpin_body(response) && response->body->size > RESPONSE_BODY_KEEP) {
+		buf_free(response->body);
+		response->body = buf_new(1024);
 	}
-	response->content_source = RC_NONE;
+	buf_reset(response->body);
 	
 	buf_reset(response->headers);
 	response->stage = RESPONSE_PREP;
+	response->close = false;
+}
+
+void response_reset(Response* response) {
+	clear(response);
+	if (response->batch->size > RESPONSE_BATCH_MAX * 2) {
+		buf_free(response->batch);
+		response->batch = buf_new(1024);
+	}
+	buf_reset(response->batch);
 }
 
 void response_free(Response* response) {
 	if (response!=NULL) {
-		for (size_t i=0; i<response->headers_count; i++) {
-			free(response->header_names[i]);
-			free(response->header_values[i]);
-		}
+		release_content(response);
+		response_zerocopy(response, 0);
+		free(response->pinned);
+		buf_free(response->spare);
 		free(response->header_names);
 		free(response->header_values);
-
-		if (response->content_source == RC_INTERNAL) {
-			buf_free(response->content);
-		}
-
+		buf_free(response->body);
 		buf_free(response->headers);
+		buf_free(response->batch);
 
 		free(response);
 	}
@@ -69,34 +115,63 @@ void response_status(Response* response, int status_code) {
 	response->status_code = status_code;
 }
 
+// every status we send, each status line is kept whole
+#define STATUSES(X) \
+	X(200, "OK") \
+	X(301, "Moved Permanently") \
+	X(304, "Not Modified") \
+	X(400, "Bad Request") \
+	X(404, "Not Found") \
+	X(405, "Method Not Allowed") \
+	X(408, "Request Timeout") \
+	X(414, "URI Too Long") \
+	X(431, "Request Header Fields Too Large") \
+	X(500, "Internal Server Error") \
+	X(501, "Not Implemented") \
+	X(503, "Service Unavailable") \
+	X(505, "HTTP Version Not Supported")
+
 static char* status_text(int status) {
 	switch (status) {
-		case 200: return "OK";
-		case 301: return "Moved Permanently";
-		case 304: return "Not Modified";
-		case 400: return "Bad Request";
-		case 404: return "Not Found";
-		case 405: return "Method Not Allowed";
-		case 500: return "Internal Server Error";
-		case 501: return "Not Implemented";
-		case 505: return "HTTP Version Not Supported";
+#define X(code, text) case code: return text;
+		STATUSES(X)
+#undef X
 		default:
 			ERROR("Unknown status code %d", status);
 			return "?";
 	}
 }
 
-static char* copy_string(const char* value) {
-	size_t len = strlen(value);
-	char* new = allocate(NULL, len+1);
-	return strcpy(new, value);
+// NULL for a status we don't know
+static const char* status_line(int status, size_t* length) {
+	switch (status) {
+#define X(code, text) case code: *length = sizeof("HTTP/1.1 " #code " " text "\r\n") - 1; return "HTTP/1.1 " #code " " text "\r\n";
+		STATUSES(X)
+#undef X
+		default:
+			return NULL;
+	}
+}
+
+#define APPEND_LITERAL(buf, str) buf_append(buf, str, sizeof(str) - 1)
+
+// "Name: value\r\n" in one go
+static void append_field(Buffer* buf, const char* name, size_t name_len, const char* value, size_t value_len) {
+	char* at = buf_reserve(buf, name_len + value_len + 4);
+	memcpy(at, name, name_len);
+	at += name_len;
+	*at++ = ':';
+	*at++ = ' ';
+	memcpy(at, value, value_len);
+	at += value_len;
+	*at++ = '\r';
+	*at = '\n';
 }
 
 void response_header(Response* response, const char* name, const char* value) {
 	for (size_t i=0; i<response->headers_count; i++) {
 		if (strcmp(response->header_names[i], name)==0) {
-			free(response->header_values[i]);
-			response->header_values[i] = copy_string(value);
+			response->header_values[i] = arena_strdup(response->arena, value);
 			return;
 		}
 	}
@@ -108,8 +183,8 @@ void response_header(Response* response, const char* name, const char* value) {
 		response->header_values = allocate(response->header_values, sizeof(*response->header_values) * response->headers_size);
 	}
 
-	response->header_names[response->headers_count] = copy_string(name);
-	response->header_values[response->headers_count] = copy_string(value);
+	response->header_names[response->headers_count] = arena_strdup(response->arena, name);
+	response->header_values[response->headers_count] = arena_strdup(response->arena, value);
 	response->headers_count++;
 }
 
@@ -119,87 +194,349 @@ void response_date(Response* response, const char* name, time_t date) {
 	response_header(response, name, buffer);
 }
 
+// the connection can't be used again after this response, and the client is told so
+void response_close(Response* response) {
+	response->close = true;
+	response_header(response, "Connection", "close");
+}
+
 void repsonse_no_content(Response* response) {
-	if (response->content_source == RC_INTERNAL) {
-		buf_free(response->content);
-	}
+	release_content(response);
+	buf_reset(response->body);
 	response->content_source = RC_NONE;
 }
 
 void repsonse_content_headers(Response* response, char* type, size_t length) {
-	if (response->content_source == RC_INTERNAL) {
-		buf_free(response->content);
-	}
+	release_content(response);
+	buf_reset(response->body);
 	response->content_source = RC_HEADERS;
 	response->type = content_type(type);
 	response->content_length = length;
 }
 
 Buffer* response_content(Response* response, char* type) {
-	if (response->content_source != RC_INTERNAL) {
-		response->content = buf_new(1024);
-	}
+	release_content(response);
 	response->content_source = RC_INTERNAL;
+	response->content = response->body;
 	response->type = content_type(type);
 	return response->content;
 }
 
+// the buffer response_content will use, to fill before deciding to send it
+Buffer* response_body(Response* response) {
+	return response->body;
+}
+
 void repsonse_link_content(Response* response, Buffer* buf, char* type) {
-	if (response->content_source == RC_INTERNAL) {
-		buf_free(response->content);
-	}
+	release_content(response);
+	buf_reset(response->body);
 	response->content_source = RC_EXTERNAL;
 	response->content = buf;
 	response->type = content_type(type);
 }
 
+// length bytes from the start of a file, sent by the kernel a piece at a time so it's never
+// all in memory.  The response owns fd from now on
+void response_file(Response* response, int fd, size_t length, char* type) {
+	release_content(response);
+	buf_reset(response->body);
+	response->content_source = RC_FILE;
+	response->type = content_type(type);
+	response->content_length = length;
+	response->file = fd;
+	response->file_offset = 0;
+}
+
+// a body made as it's sent, each piece produced into the body once the one before has gone.
+// Chunked, or with no length at all, for HTTP/1.0, and then the connection has to close to
+// end it.  The response owns arg until produce is called with NULL
+void response_stream(Response* response, stream_fn produce, void* arg, bool chunked, char* type) {
+	release_content(response);
+	buf_reset(response->body);
+	response->content_source = RC_STREAM;
+	response->content = response->body;
+	response->type = content_type(type);
+	response->produce = produce;
+	response->produce_arg = arg;
+	response->chunked = chunked;
+}
+
+// keep one body to save allocating another, unless it's big
+static void recycle(Response* response, Buffer* buf) {
+	if (response->spare == NULL && buf->size <= RESPONSE_BODY_KEEP) {
+		buf_reset(buf);
+		response->spare = buf;
+	} else {
+		buf_free(buf);
+	}
+}
+
+// a new connection, with zerocopy sends for bodies of min or more, 0 for none.  Any bodies
+// still pinned by the last one are let go, its socket is closed
+void response_zerocopy(Response* response, size_t min) {
+	for (size_t i=0; i<response->pinned_count; i++) {
+		if (response->pinned[i].buf != response->body) {
+			recycle(response, response->pinned[i].buf);
+		}
+	}
+	response->pinned_count = 0;
+	response->zerocopy_min = min;
+	response->zerocopy_next = 0;
+}
+
+// the kernel has finished with sends first to last, bodies it's done with are freed
+void response_zerocopy_done(Response* response, uint32_t first, uint32_t last) {
+	size_t kept = 0;
+	for (size_t i=0; i<response->pinned_count; i++) {
+		ResponsePinned* pinned = &response->pinned[i];
+		uint32_t from = first > pinned->first ? first : pinned->first;
+		uint32_t to = last < pinned->last ? last : pinned->last;
+		if (from <= to) {
+			pinned->left -= to - from + 1;
+		}
+
+		if (pinned->left > 0) {
+			response->pinned[kept++] = *pinned;
+		} else if (pinned->buf != response->body) {
+			recycle(response, pinned->buf);
+		}
+	}
+	response->pinned_count = kept;
+}
+
+// true while the kernel is still sending from a body
+bool response_pinned(Response* response) {
+	return response->pinned_count > 0;
+}
+
+// the body is pinned until the kernel has finished with this send
+static void pin(Response* response, uint32_t send) {
+	if (response->pinned_count > 0 && response->pinned[response->pinned_count-1].buf == response->body) {
+		ResponsePinned* pinned = &response->pinned[response->pinned_count-1];
+		pinned->last = send;
+		pinned->left++;
+		return;
+	}
+
+	if (response->pinned_count == response->pinned_size) {
+		response->pinned_size = response->pinned_size > 0 ? response->pinned_size * 2 : 4;
+		response->pinned = allocate(response->pinned, sizeof(*response->pinned) * response->pinned_size);
+	}
+	response->pinned[response->pinned_count++] = (ResponsePinned){.buf = response->body, .first = send, .last = send, .left = 1};
+}
+
+// a generated body, or a piece of a stream, big enough to be worth it
+static bool zerocopy(Response* response) {
+	return response->zerocopy_min > 0 && (response->content_source == RC_INTERNAL || response->content_source == RC_STREAM) &&
+		(size_t)response->content->length >= response->zerocopy_min;
+}
+
 static void next_stage(Response* response) {
 	response->stage++;
 	if (response->stage == RESPONSE_CONTENT) {
-		if (response->content_source == RC_NONE || response->content_source == RC_HEADERS) {
+		if (response->content_source == RC_NONE || response->content_source == RC_HEADERS || (response->content_source == RC_FILE && response->content_length == 0) ||
+				(response->content_source == RC_STREAM && response->produce == NULL && buf_read_max(response->content) == 0)) {
 			response->stage++;
 		}
 	}
 }
 
-static void build_headers(Response* response) {
-	TRACE("build response headers");
+// the date line only changes once a second, it's kept for each thread
+#define DATE_LINE_LEN (6 + IMF_DATE_LEN - 1 + 2)
+
+static void append_date(Buffer* buf) {
+	static _Thread_local time_t last_seconds = -1;
+	static _Thread_local char line[DATE_LINE_LEN + 1];
+
+	time_t now = time(NULL);
+	if (now != last_seconds) {
+		memcpy(line, "Date: ", 6);
+		to_imf_date(line + 6, IMF_DATE_LEN, now);
+		memcpy(line + 6 + IMF_DATE_LEN - 1, "\r\n", 2);
+		last_seconds = now;
+	}
+	buf_append(buf, line, DATE_LINE_LEN);
+}
 
+static void build_status(Response* response, Buffer* buf) {
 	// status line
-	buf_append_format(response->headers, "HTTP/1.1 %d %s\r\n", response->status_code, status_text(response->status_code));
+	size_t length;
+	const char* line = status_line(response->status_code, &length);
+	if (line != NULL) {
+		buf_append(buf, line, length);
+	} else {
+		buf_append_format(buf, "HTTP/1.1 %d %s\r\n", response->status_code, status_text(response->status_code));
+	}
 
 	// date header
-	buf_append_str(response->headers, "Date: ");
-	to_imf_date(buf_reserve(response->headers, IMF_DATE_LEN), IMF_DATE_LEN, time(NULL));
-	buf_advance_write(response->headers, -1);
-	buf_append_str(response->headers, "\r\n");
+	append_date(buf);
+}
 
+static void build_fields(Response* response, Buffer* buf) {
 	// server header
-	buf_append_str(response->headers, "Server: Tinn\r\n");
+	APPEND_LITERAL(buf, "Server: Tinn\r\n");
 
 	// content headers
 	if (response->content_source != RC_NONE) {
-		buf_append_format(response->headers, "Content-Type: %s\r\n", response->type);
-		if (response->content_source == RC_HEADERS) {
-			buf_append_format(response->headers, "Content-Length: %ld\r\n", response->content_length);
+		append_field(buf, "Content-Type", 12, response->type, strlen(response->type));
+
+		if (response->content_source == RC_STREAM) {
+			if (response->chunked) {
+				APPEND_LITERAL(buf, "Transfer-Encoding: chunked\r\n");
+			}
 		} else {
-			buf_append_format(response->headers, "Content-Length: %ld\r\n", response->content->length);
+			char length[DECIMAL_LEN];
+			bool known = response->content_source == RC_HEADERS || response->content_source == RC_FILE;
+			size_t digits = to_decimal(length, known ? response->content_length : (size_t)response->content->length);
+			append_field(buf, "Content-Length", 14, length, digits);
 		}
-		
 	}
 
 	// other headers
 	for (size_t i=0; i<response->headers_count; i++) {
-		buf_append_format(response->headers, "%s: %s\r\n", response->header_names[i], response->header_values[i]);
+		append_field(buf, response->header_names[i], strlen(response->header_names[i]), response->header_values[i], strlen(response->header_values[i]));
 	}
 
 	// close with empty line
-	buf_append_str(response->headers, "\r\n");
+	APPEND_LITERAL(buf, "\r\n");
+}
+
+static void build_headers(Response* response) {
+	TRACE("build response headers");
+
+	build_status(response, response->headers);
+	build_fields(response, response->headers);
 
 	next_stage(response);
 }
 
-ssize_t response_send(Response* response, int socket) {
+// everything after the date, headers and content, for a response that never changes.
+// The status code is needed again to send it
+Buffer* response_serialize(Response* response) {
+	Buffer* buf = buf_new(1024);
+	build_fields(response, buf);
+	if (response->content_source == RC_INTERNAL || response->content_source == RC_EXTERNAL) {
+		buf_append(buf, buf_read_ptr(response->content), buf_read_max(response->content));
+	}
+	return buf;
+}
+
+// send a response from response_serialize, only the status line and date are built
+void response_preserialized(Response* response, int status_code, const Buffer* serialized) {
+	response_status(response, status_code);
+	repsonse_no_content(response);
+	build_status(response, response->headers);
+	buf_append(response->headers, serialized->data, serialized->length);
+	response->stage = RESPONSE_HEADERS;
+}
+
+// hold the response back to go out with the next one, false if the batch is full and it
+// should be sent now.  The response is ready to use again
+bool response_batch(Response* response) {
+	if (response->content_source == RC_FILE || response->content_source == RC_STREAM || zerocopy(response)) {
+		return false;
+	}
+	if (response->stage == RESPONSE_PREP) {
+		build_headers(response);
+	}
+
+	long length = buf_read_max(response->headers);
+	if (response->content_source == RC_INTERNAL || response->content_source == RC_EXTERNAL) {
+		length += buf_read_max(response->content);
+	}
+	if (response->batch->length + length > RESPONSE_BATCH_MAX) {
+		return false;
+	}
+
+	buf_append(response->batch, buf_read_ptr(response->headers), buf_read_max(response->headers));
+	if (response->content_source == RC_INTERNAL || response->content_source == RC_EXTERNAL) {
+		buf_append(response->batch, buf_read_ptr(response->content), buf_read_max(response->content));
+	}
+	clear(response);
+	return true;
+}
+
+// room for the size of a chunk in hex and its CRLF, the size goes at the end of it
+#define CHUNK_HEAD_LEN (sizeof(size_t) * 2 + 2)
+
+static const char hex_digits[] = "0123456789abcdef";
+
+// the next piece of a stream into the body, framed as a chunk when it's chunked.  A piece the
+// kernel is still sending from is left to it
+static void produce(Response* response) {
+	unpin_body(response);
+	Buffer* body = response->body;
+	response->content = body;
+	buf_reset(body);
+	if (response->chunked) {
+		buf_reserve(body, CHUNK_HEAD_LEN);
+	}
+
+	bool more = response->produce(response->produce_arg, body);
+	if (!more) {
+		release_content(response);
+	}
+	if (!response->chunked) {
+		return;
+	}
+
+	size_t length = body->length - CHUNK_HEAD_LEN;
+	if (length > 0) {
+		char* at = body->data + CHUNK_HEAD_LEN;
+		*--at = '\n';
+		*--at = '\r';
+		for (size_t n=length; n>0; n>>=4) {
+			*--at = hex_digits[n & 0xf];
+		}
+		buf_advance_read(body, at - body->data);
+		APPEND_LITERAL(body, "\r\n");
+	} else {
+		buf_reset(body);
+	}
+	if (!more) {
+		APPEND_LITERAL(body, "0\r\n\r\n");
+	}
+}
+
+static ssize_t send_file(Response* response, Sockets* sockets, size_t index) {
+	size_t left = response->content_length - response->file_offset;
+	ssize_t sent = sockets_sendfile(sockets, index, response->file, &response->file_offset, left);
+	if (sent == 0) {
+		// it shrank, and the length has already gone
+		WARN("file being sent was cut short");
+		errno = EIO;
+		return -1;
+	}
+	if (sent > 0) {
+		TRACE("sent file: %ld", sent);
+		if ((size_t)response->file_offset == response->content_length) {
+			next_stage(response);
+		}
+	}
+	return sent;
+}
+
+static ssize_t send_zerocopy(Response* response, Sockets* sockets, size_t index) {
+	Buffer* content = response->content;
+	ssize_t sent = sockets_send_zerocopy(sockets, index, buf_read_ptr(content), buf_read_max(content));
+	if (sent < 0 && errno == ENOBUFS) {
+		struct iovec iov = {.iov_base = buf_read_ptr(content), .iov_len = buf_read_max(content)};
+		sent = sockets_send(sockets, index, &iov, 1);
+	} else if (sent > 0) {
+		pin(response, response->zerocopy_next++);
+	}
+
+	if (sent > 0) {
+		TRACE("sent zerocopy: %ld", sent);
+		buf_advance_read(content, sent);
+		if (buf_read_max(content) == 0 && response->produce == NULL) {
+			next_stage(response);
+		}
+	}
+	return sent;
+}
+
+ssize_t response_send(Response* response, Sockets* sockets, size_t index) {
 	if (response->stage == RESPONSE_PREP) {
 		build_headers(response);
 	}
@@ -209,17 +546,75 @@ ssize_t response_send(Response* response, int socket) {
 		return 0;
 	}
 
-	Buffer* buf = (response->stage == RESPONSE_HEADERS) ? response->headers : response->content;
-	
-	size_t len = buf_read_max(buf);
-	ssize_t sent = send(socket, buf_read_ptr(buf), len, MSG_DONTWAIT);
+	// the next piece of a stream once the last has gone, the first goes with the headers
+	if (response->content_source == RC_STREAM) {
+		while (response->produce != NULL && buf_read_max(response->content) == 0) {
+			produce(response);
+		}
+		if (response->stage == RESPONSE_CONTENT && buf_read_max(response->content) == 0) {
+			next_stage(response);
+			return 0;
+		}
+	}
+
+	// a file, or a body sent without copying, goes once everything before it has
+	bool separate = response->content_source == RC_FILE || zerocopy(response);
+	if (response->stage == RESPONSE_CONTENT && separate && buf_read_max(response->batch) == 0) {
+		return response->content_source == RC_FILE ? send_file(response, sockets, index) : send_zerocopy(response, sockets, index);
+	}
+
+	// offer everything left, the batch, headers and content, the backend decides how much to
+	// send in one go
+	struct iovec iov[3];
+	int count = 0;
+	if (buf_read_max(response->batch) > 0) {
+		iov[count].iov_base = buf_read_ptr(response->batch);
+		iov[count].iov_len = buf_read_max(response->batch);
+		count++;
+	}
+	if (response->stage == RESPONSE_HEADERS) {
+		iov[count].iov_base = buf_read_ptr(response->headers);
+		iov[count].iov_len = buf_read_max(response->headers);
+		count++;
+	}
+	if (!separate && (response->content_source == RC_INTERNAL || response->content_source == RC_EXTERNAL || response->content_source == RC_STREAM)) {
+		if (buf_read_max(response->content) > 0) {
+			iov[count].iov_base = buf_read_ptr(response->content);
+			iov[count].iov_len = buf_read_max(response->content);
+			count++;
+		}
+	}
+
+	ssize_t sent = sockets_send(sockets, index, iov, count);
 	if (sent >= 0) {
-		TRACE("sent %d: %ld/%ld", response->stage, sent, len);
-		if ((size_t)sent < len) {
-			buf_advance_read(buf, sent);
-		} else {
+		TRACE("sent %d: %ld", response->stage, sent);
+
+		// move through the batch and the stages by what was sent
+		size_t left = sent;
+		if (buf_read_max(response->batch) > 0) {
+			size_t len = buf_read_max(response->batch);
+			if (left < len) {
+				buf_advance_read(response->batch, left);
+				return sent;
+			}
+			left -= len;
+			buf_advance_read(response->batch, len);
+		}
+		if (response->stage == RESPONSE_HEADERS) {
+			size_t len = buf_read_max(response->headers);
+			if (left < len) {
+				buf_advance_read(response->headers, left);
+				return sent;
+			}
+			left -= len;
 			next_stage(response);
 		}
+		if (response->stage == RESPONSE_CONTENT && !separate) {
+			buf_advance_read(response->content, left);
+			if (buf_read_max(response->content) == 0 && response->produce == NULL) {
+				next_stage(response);
+			}
+		}
 	}
 	return sent;
 }
@@ -259,5 +654,8 @@ void response_redirect(Response* response, char* location) {
 }
 
 #undef RC_NONE
+#undef RC_HEADERS
 #undef RC_INTERNAL
-#undef RC_EXTERNAL
\ No newline at end of file
+#undef RC_EXTERNAL
+#undef RC_FILE
+#undef RC_STREAM
\ No newline at end of file
@@ -2,14 +2,40 @@
 #define TINN_RESPONSE_H
 
 #include "buffer.h"
+#include "net.h"
+#include "arena.h"
 #include <time.h>
+#include <stdint.h>
+#include <sys/types.h>
 
 #define RESPONSE_PREP 0
 #define RESPONSE_HEADERS 1
 #define RESPONSE_CONTENT 2
 #define RESPONSE_DONE 3
 
+// header names and values come from the arena, the content buffer is kept between
+// responses unless it grew past RESPONSE_BODY_KEEP
+#define RESPONSE_BODY_KEEP 65536
+
+// responses to pipelined requests are held back and sent together, up to this much
+#define RESPONSE_BATCH_MAX 65536
+
+// a streamed body is asked for a piece at a time, each appended to out, returning false
+// after the last.  Each time has to add something or finish.  It's only asked again once the
+// last piece has gone, so a slow reader holds it up.  Called with out NULL when the response
+// is let go, finished or not, for arg to go too
+typedef bool (*stream_fn)(void* arg, Buffer* out);
+
+// a body the kernel is still sending from with MSG_ZEROCOPY, from its first to last send
+typedef struct {
+	Buffer* buf;
+	uint32_t first;
+	uint32_t last;
+	uint32_t left;
+} ResponsePinned;
+
 typedef struct {
+	Arena* arena;
 	int status_code;
 
 	size_t headers_size;
@@ -21,25 +47,55 @@ typedef struct {
 	const char* type;
 	Buffer* content;
 	size_t content_length;
+	Buffer* body;
+	int file; // sent with sendfile and closed after, see response_file
+	off_t file_offset;
+	stream_fn produce; // NULL once a stream has no more to come, see response_stream
+	void* produce_arg;
+	bool chunked;
 
 	Buffer* headers;
 	unsigned short stage;
+	bool close; // the connection closes once this is sent, see response_close
+
+	Buffer* batch; // earlier responses, sent first
+
+	// bodies, or pieces of a stream, this big or more are sent with MSG_ZEROCOPY, 0 for
+	// never.  For the connection, not each response
+	size_t zerocopy_min;
+	uint32_t zerocopy_next;
+	size_t pinned_size;
+	size_t pinned_count;
+	ResponsePinned* pinned;
+	Buffer* spare; // a body the kernel has finished with, for the next one
 } Response;
 
-Response* response_new();
+Response* response_new(Arena* arena);
 void response_reset(Response* response);
 void response_free(Response* response);
 
 void response_status(Response* response, int status_code);
 void response_header(Response* response, const char* name, const char* value);
 void response_date(Response* response, const char* name, time_t date);
+void response_close(Response* response);
 
 void repsonse_no_content(Response* response);
 void repsonse_content_headers(Response* response, char* type, size_t length);
 Buffer* response_content(Response* response, char* type);
+Buffer* response_body(Response* response);
 void repsonse_link_content(Response* response, Buffer* buf, char* type);
+void response_file(Response* response, int fd, size_t length, char* type);
+void response_stream(Response* response, stream_fn produce, void* arg, bool chunked, char* type);
+
+void response_zerocopy(Response* response, size_t min);
+void response_zerocopy_done(Response* response, uint32_t first, uint32_t last);
+bool response_pinned(Response* response);
+
+bool response_batch(Response* response);
+ssize_t response_send(Response* response, Sockets* sockets, size_t index);
 
-ssize_t response_send(Response* response, int socket);
+Buffer* response_serialize(Response* response);
+void response_preserialized(Response* response, int status_code, const Buffer* serialized);
 
 void response_error(Response* response, int status_code);
 void response_redirect(Response* response, char* location);
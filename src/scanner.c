@@ -1,7 +1,48 @@
 #include <string.h>
 
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
 #include "scanner.h"
 
+// building the ready made sets at compile time, '\0' is never a delimiter
+#define DELIMITER_WORD(c, word) ((c) != 0 && (unsigned char)(c) / 64 == (word) ? 1ULL << ((unsigned char)(c) % 64) : 0)
+#define DELIMITER_BITS(a, b, c) { \
+	DELIMITER_WORD(a, 0) | DELIMITER_WORD(b, 0) | DELIMITER_WORD(c, 0), \
+	DELIMITER_WORD(a, 1) | DELIMITER_WORD(b, 1) | DELIMITER_WORD(c, 1), \
+	DELIMITER_WORD(a, 2) | DELIMITER_WORD(b, 2) | DELIMITER_WORD(c, 2), \
+	DELIMITER_WORD(a, 3) | DELIMITER_WORD(b, 3) | DELIMITER_WORD(c, 3) }
+
+const Delimiters scan_crlf = { DELIMITER_BITS('\r', '\n', 0), 2, { '\r', '\n' } };
+const Delimiters scan_space = { DELIMITER_BITS(' ', 0, 0), 1, { ' ', 0 } };
+const Delimiters scan_tab = { DELIMITER_BITS('\t', 0, 0), 1, { '\t', 0 } };
+const Delimiters scan_header_name = { DELIMITER_BITS(':', ' ', '\t'), 3, { 0, 0 } };
+const Delimiters scan_rest = { DELIMITER_BITS(0, 0, 0), 0, { 0, 0 } };
+
+#undef DELIMITER_BITS
+#undef DELIMITER_WORD
+
+Delimiters delimiters_new(const char* chars) {
+	Delimiters delims;
+	memset(&delims, 0, sizeof(delims));
+	for (const unsigned char* c = (const unsigned char*)chars; *c; c++) {
+		if (delims.count < 2) {
+			delims.chars[delims.count] = *c;
+		}
+		delims.bits[*c / 64] |= 1ULL << (*c % 64);
+		delims.count++;
+	}
+	if (delims.count > 2) {
+		delims.chars[0] = delims.chars[1] = 0;
+	}
+	return delims;
+}
+
+static bool is_delimiter(const Delimiters* delims, unsigned char c) {
+	return (delims->bits[c / 64] >> (c % 64)) & 1;
+}
+
 Scanner scanner_new(const char* source, const size_t length) {
 	Scanner scanner = {
 		.start = source,
@@ -12,34 +53,135 @@ Scanner scanner_new(const char* source, const size_t length) {
 	return scanner;
 }
 
-static bool at_end(Scanner* scanner) {
-	return scanner->read == scanner->length || *(scanner->current) == '\0';
-}
-
-static char peek(Scanner* scanner) {
-	return *(scanner->current);
-}
-
-static void advance(Scanner* scanner) {
-	scanner->current++;
-	scanner->read++;
+// the first byte from i on that's a delimiter or the end of the input, a '\0' or length
+static size_t find_stop(const char* data, size_t i, size_t length, const Delimiters* delims) {
+#ifdef __SSE2__
+	if (delims->count <= 2) {
+		// with fewer than two delimiters the spare compare looks for '\0' again
+		const __m128i first = _mm_set1_epi8(delims->chars[0]);
+		const __m128i second = _mm_set1_epi8(delims->chars[1]);
+		const __m128i end = _mm_setzero_si128();
+		for (; i + 16 <= length; i += 16) {
+			__m128i bytes = _mm_loadu_si128((const __m128i*)(data + i));
+			__m128i stop = _mm_or_si128(
+				_mm_or_si128(_mm_cmpeq_epi8(bytes, first), _mm_cmpeq_epi8(bytes, second)),
+				_mm_cmpeq_epi8(bytes, end));
+			unsigned mask = _mm_movemask_epi8(stop);
+			if (mask != 0) {
+				return i + __builtin_ctz(mask);
+			}
+		}
+	}
+#endif
+	while (i < length && data[i] != '\0' && !is_delimiter(delims, data[i])) {
+		i++;
+	}
+	return i;
 }
 
-Token scan_token(Scanner* scanner, const char* delims) {
-	while (!at_end(scanner) && strchr(delims, peek(scanner))==NULL) {
-		advance(scanner);
-	}
+// a token up to the next delimiter, then skip past any delimiters after it
+Token scan_delimited(Scanner* scanner, const Delimiters* delims) {
+	const char* data = scanner->current - scanner->read;
+	size_t i = find_stop(data, scanner->read, scanner->length, delims);
 	Token rv = {
 		.start = scanner->start,
-		.length = (int)(scanner->current - scanner->start)
+		.length = (int)(data + i - scanner->start)
 	};
-	while (!at_end(scanner) && strchr(delims, peek(scanner))!=NULL) {
-		advance(scanner);
+	while (i < scanner->length && is_delimiter(delims, data[i])) {
+		i++;
 	}
+	scanner->current = data + i;
+	scanner->read = i;
 	scanner->start = scanner->current;
 	return rv;
 }
 
+Token scan_token(Scanner* scanner, const char* delims) {
+	Delimiters set = delimiters_new(delims);
+	return scan_delimited(scanner, &set);
+}
+
 bool token_is(Token token, const char* str) {
 	return strlen(str)==token.length && strncmp(token.start, str, token.length)==0;
+}
+
+static bool is_header_end(const char* data) {
+	return data[0]=='\r' && data[1]=='\n' && data[2]=='\r' && data[3]=='\n';
+}
+
+// whole vectors from *from on, returns where the blank line starts, or -1 having moved *from
+// on to the bytes left over.  Positions where "\r\n\r\n" starts are found by comparing four
+// loads, each a byte further on, and anding them together
+#if defined(__AVX2__)
+#define VECTOR_WIDTH 32
+static long vector_header_end(const char* data, long* from, long length) {
+	long i = *from;
+	const __m256i cr = _mm256_set1_epi8('\r');
+	const __m256i lf = _mm256_set1_epi8('\n');
+	for (; i + VECTOR_WIDTH + 3 <= length; i += VECTOR_WIDTH) {
+		__m256i match = _mm256_and_si256(
+			_mm256_and_si256(
+				_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)(data + i)), cr),
+				_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)(data + i + 1)), lf)),
+			_mm256_and_si256(
+				_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)(data + i + 2)), cr),
+				_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)(data + i + 3)), lf)));
+		unsigned mask = _mm256_movemask_epi8(match);
+		if (mask != 0) {
+			return i + __builtin_ctz(mask);
+		}
+	}
+	*from = i;
+	return -1;
+}
+#elif defined(__SSE2__)
+#define VECTOR_WIDTH 16
+static long vector_header_end(const char* data, long* from, long length) {
+	long i = *from;
+	const __m128i cr = _mm_set1_epi8('\r');
+	const __m128i lf = _mm_set1_epi8('\n');
+	for (; i + VECTOR_WIDTH + 3 <= length; i += VECTOR_WIDTH) {
+		__m128i match = _mm_and_si128(
+			_mm_and_si128(
+				_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(data + i)), cr),
+				_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(data + i + 1)), lf)),
+			_mm_and_si128(
+				_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(data + i + 2)), cr),
+				_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(data + i + 3)), lf)));
+		unsigned mask = _mm_movemask_epi8(match);
+		if (mask != 0) {
+			return i + __builtin_ctz(mask);
+		}
+	}
+	*from = i;
+	return -1;
+}
+#endif
+
+// find the blank line ending a request header, searching from where it could start.  Returns
+// the offset just past it, or -1.  Callers searching a growing buffer start again 3 bytes
+// before where they got to, in case the end was split
+long scan_header_end(const char* data, long from, long length) {
+	long i = from < 0 ? 0 : from;
+
+#ifdef VECTOR_WIDTH
+	long found = vector_header_end(data, &i, length);
+	if (found >= 0) {
+		return found + 4;
+	}
+#endif
+
+	// the rest, skipping to each '\r'
+	while (i + 4 <= length) {
+		const char* cr = memchr(data + i, '\r', length - i - 3);
+		if (cr == NULL) {
+			break;
+		}
+		i = cr - data;
+		if (is_header_end(cr)) {
+			return i + 4;
+		}
+		i++;
+	}
+	return -1;
 }
\ No newline at end of file
@@ -2,6 +2,8 @@
 #define TINN_SCANNER_H
 
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 
 typedef struct {
 	const char* start;
@@ -15,9 +17,29 @@ typedef struct {
 	size_t length;
 } Token;
 
+// a set of delimiters as a bitmap of all 256 byte values, sets of one or two are also
+// searched for a vector at a time.  The common ones are ready made, others can be made
+// once with delimiters_new and kept
+typedef struct {
+	uint64_t bits[4];
+	int count;
+	char chars[2]; // when there are no more than two
+} Delimiters;
+
+extern const Delimiters scan_crlf;
+extern const Delimiters scan_space;
+extern const Delimiters scan_tab;
+extern const Delimiters scan_header_name; // ": \t"
+extern const Delimiters scan_rest; // none, the rest of the input
+
+Delimiters delimiters_new(const char* chars);
+
 Scanner scanner_new(const char* source, const size_t length);
 Token scan_token(Scanner* scanner, const char* delims);
+Token scan_delimited(Scanner* scanner, const Delimiters* delims);
 
 bool token_is(Token token, const char* str);
 
+long scan_header_end(const char* data, long from, long length);
+
 #endif
\ No newline at end of file
@@ -1,3 +1,6 @@
+#include <errno.h>
+#include <string.h>
+
 #include "console.h"
 #include "server.h"
 #include "client.h"
@@ -18,39 +21,131 @@ static void *get_in_addr(struct sockaddr *sa) {
 	return &(((struct sockaddr_in6*)sa)->sin6_addr);
 }
 
-static void server_listener(Sockets* sockets, int index) {
-	struct pollfd* pfd = &sockets->pollfds[index];
-	ServerState* server_state = sockets->states[index];
-
+// take one connection, false when there are none left
+static bool accept_client(Sockets* sockets, int index, ServerState* server_state) {
 	struct sockaddr_storage address;
 	socklen_t address_size;
 	int client_socket;
 	ClientState* client_state;
-	int client_index;
+
+	do {
+		address_size = sizeof(address);
+		client_socket = sockets_accept(sockets, index, (struct sockaddr *)&address, &address_size);
+	} while (client_socket < 0 && (errno == ECONNABORTED || errno == EINTR));
+
+	if (client_socket < 0) {
+		if (errno != EAGAIN && errno != EWOULDBLOCK) {
+			ERROR("accept");
+		}
+		return false;
+	}
+
+	client_state = client_new(sockets, client_socket, server_state->proxy_protocol, server_state->content, server_state->config, server_state->load);
+	if (address.ss_family == AF_INET || address.ss_family == AF_INET6) {
+		inet_ntop(address.ss_family, get_in_addr((struct sockaddr *)&address), client_state->address, INET6_ADDRSTRLEN);
+	} else {
+		strcpy(client_state->address, "local");
+	}
+
+	LOG("connection from %s (%d) opened", client_state->address, client_socket);
+	return true;
+}
+
+// the server socket is being closed, take what has already been accepted and close
+static void finish_stopping(Sockets* sockets, int index, ServerState* server_state) {
+	ClientLoad* load = server_state->load;
+
+	while (accept_client(sockets, index, server_state));
+
+	sockets_close(sockets, index);
+	server_state_free(server_state);
+
+	for (size_t i=0; i<load->servers_count; i++) {
+		if (load->servers[i] == (size_t)index) {
+			load->servers[i] = load->servers[--load->servers_count];
+			break;
+		}
+	}
+}
+
+static void server_listener(Sockets* sockets, int index) {
+	struct pollfd* pfd = &sockets->pollfds[index];
+	ServerState* server_state = sockets->states[index];
+	const ClientConfig* config = server_state->config;
+	ClientLoad* load = server_state->load;
+
+	if (pfd->revents & SOCKET_TIMEOUT) {
+		finish_stopping(sockets, index, server_state);
+		return;
+	}
 
 	if (pfd->revents & (POLLERR | POLLHUP | POLLNVAL)) {
 		PANIC("error on server socket: %d", pfd->revents);
 	} 
 	
-	address_size = sizeof(address);
-	if ((client_socket = accept(pfd->fd, (struct sockaddr *)&address, &address_size)) < 0) {
-		ERROR("accept");
-	} else {
-		client_index = sockets_add(sockets, client_socket, client_listener);
+	// accept everything waiting, edge triggered backends won't tell us again.  Stop after a
+	// batch so clients get a turn in a burst, and come back for the rest
+	for (int accepted = 0; ; accepted++) {
+		if (config->max_connections > 0 && load->connections >= config->max_connections) {
+			server_pause(sockets, load);
+			return;
+		}
+		if (config->accept_batch > 0 && accepted == config->accept_batch) {
+			sockets_again(sockets, index, POLLIN);
+			return;
+		}
+		if (!accept_client(sockets, index, server_state)) {
+			return;
+		}
+	}
+}
 
-		client_state = client_state_new();
-		client_state->content = server_state->content;
-		inet_ntop(address.ss_family, get_in_addr((struct sockaddr *)&address), client_state->address, INET6_ADDRSTRLEN);
-		sockets->states[client_index] = client_state;		
+// stop accepting when full, new connections wait in the kernel's backlog until there's room
+void server_pause(Sockets* sockets, ClientLoad* load) {
+	if (!load->paused) {
+		WARN("%ld connections, not accepting any more for now", load->connections);
+		for (size_t i=0; i<load->servers_count; i++) {
+			sockets_set_events(sockets, load->servers[i], 0);
+		}
+		load->paused = true;
+	}
+}
 
-		LOG("connection from %s (%d) opened", client_state->address, client_socket);
+void server_resume(Sockets* sockets, ClientLoad* load) {
+	if (load->paused) {
+		LOG("%ld connections, accepting again", load->connections);
+		for (size_t i=0; i<load->servers_count; i++) {
+			sockets_set_events(sockets, load->servers[i], POLLIN);
+		}
+		load->paused = false;
 	}
 }
 
-void server_new(Sockets* sockets, int socket, ContentGenerators* content) {
+// stop accepting and close the server sockets, when they've been handed to another process
+// it keeps them open.  Completion backends may have accepts in flight, so the sockets are
+// closed a tick later, taking anything accepted in the meantime
+void server_stop(Sockets* sockets, ClientLoad* load) {
+	for (size_t i=0; i<load->servers_count; i++) {
+		sockets_set_events(sockets, load->servers[i], 0);
+		sockets_set_timeout(sockets, load->servers[i], TIMER_TICK);
+	}
+	load->paused = false;
+}
+
+void server_new(Sockets* sockets, int socket, bool proxy_protocol, ContentGenerators* content, const ClientConfig* config, ClientLoad* load) {
 	int index = sockets_add(sockets, socket, server_listener);
 
 	ServerState* state = server_state_new();
+	state->proxy_protocol = proxy_protocol;
 	state->content = content;
-	sockets->states[index] = state;	
+	state->config = config;
+	state->load = load;
+	sockets->states[index] = state;
+
+	// sockets keep their index for as long as they are open
+	if (load->servers_count == load->servers_size) {
+		load->servers_size = load->servers_size ? load->servers_size * 2 : 2;
+		load->servers = allocate(load->servers, sizeof(*load->servers) * load->servers_size);
+	}
+	load->servers[load->servers_count++] = index;
 }
\ No newline at end of file
@@ -2,13 +2,20 @@
 #define TINN_SERVER_H
 
 #include "content_generator.h"
+#include "client.h"
 #include "net.h"
 
 typedef struct {
+	bool proxy_protocol; // for this listener, connections start with a PROXY protocol header
 	ContentGenerators* content;
+	const ClientConfig* config;
+	ClientLoad* load;
 } ServerState;
 
-void server_new(Sockets* sockets, int socket, ContentGenerators* content);
+void server_new(Sockets* sockets, int socket, bool proxy_protocol, ContentGenerators* content, const ClientConfig* config, ClientLoad* load);
+void server_pause(Sockets* sockets, ClientLoad* load);
+void server_resume(Sockets* sockets, ClientLoad* load);
+void server_stop(Sockets* sockets, ClientLoad* load);
 //void server_listener(Sockets* sockets, int index);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,152 @@
+#ifdef __linux__
+
+#include <errno.h>
+#include <string.h>
+#include <sys/epoll.h>
+
+#include "utils.h"
+#include "net.h"
+#include "console.h"
+
+// the epoll backend registers each socket once, edge triggered, and only hears about the
+// sockets that have activity, so a wakeup costs O(events) no matter how many sockets are idle.
+// Being edge triggered listeners must read/write/accept until they get EAGAIN.
+
+typedef struct {
+	int epoll_fd;
+	struct epoll_event* events;
+} EpollState;
+
+static uint32_t to_epoll_events(short events) {
+	uint32_t rv = EPOLLET;
+	if (events & POLLIN) {
+		rv |= EPOLLIN;
+	}
+	if (events & POLLOUT) {
+		rv |= EPOLLOUT;
+	}
+	return rv;
+}
+
+static short to_poll_events(uint32_t events) {
+	short rv = 0;
+	if (events & EPOLLIN) {
+		rv |= POLLIN;
+	}
+	if (events & EPOLLOUT) {
+		rv |= POLLOUT;
+	}
+	if (events & EPOLLERR) {
+		rv |= POLLERR;
+	}
+	if (events & EPOLLHUP) {
+		rv |= POLLHUP;
+	}
+	return rv;
+}
+
+static bool epoll_init(Sockets* list) {
+	int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (epoll_fd < 0) {
+		ERROR("epoll_create1");
+		return false;
+	}
+
+	EpollState* state = allocate(NULL, sizeof(*state));
+	state->epoll_fd = epoll_fd;
+	state->events = allocate(NULL, sizeof(*state->events) * list->max_events);
+
+	list->backend_state = state;
+	return true;
+}
+
+static void epoll_free(Sockets* list) {
+	EpollState* state = list->backend_state;
+	if (state != NULL) {
+		close(state->epoll_fd);
+		free(state->events);
+		free(state);
+		list->backend_state = NULL;
+	}
+}
+
+static void epoll_add(Sockets* list, size_t index) {
+	EpollState* state = list->backend_state;
+	struct pollfd* pfd = &list->pollfds[index];
+
+	struct epoll_event event;
+	memset(&event, 0, sizeof(event));
+	event.events = to_epoll_events(pfd->events);
+	event.data.u64 = sockets_id(list, index);
+
+	if (epoll_ctl(state->epoll_fd, EPOLL_CTL_ADD, pfd->fd, &event) != 0) {
+		ERROR("epoll_ctl add %d", pfd->fd);
+	}
+}
+
+// modifying the registration re-checks readiness, so an edge missed while not listening
+// for it is reported again
+static void epoll_update(Sockets* list, size_t index) {
+	EpollState* state = list->backend_state;
+	struct pollfd* pfd = &list->pollfds[index];
+
+	struct epoll_event event;
+	memset(&event, 0, sizeof(event));
+	event.events = to_epoll_events(pfd->events);
+	event.data.u64 = sockets_id(list, index);
+
+	if (epoll_ctl(state->epoll_fd, EPOLL_CTL_MOD, pfd->fd, &event) != 0) {
+		ERROR("epoll_ctl modify %d", pfd->fd);
+	}
+}
+
+static void epoll_remove(Sockets* list, size_t index) {
+	EpollState* state = list->backend_state;
+	int fd = list->pollfds[index].fd;
+
+	// closing a socket removes it from the epoll set anyway, so ignore errors
+	epoll_ctl(state->epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+}
+
+static int epoll_dispatch(Sockets* list, int timeout) {
+	EpollState* state = list->backend_state;
+
+	int ready = epoll_wait(state->epoll_fd, state->events, list->max_events, timeout);
+	if (ready < 0) {
+		return errno == EINTR ? 0 : -1;
+	}
+
+	for (int i = 0; i < ready; i++) {
+		// events carry the socket's id, earlier listeners may have removed it and its slot
+		// may even have been re-used
+		long index = sockets_lookup(list, state->events[i].data.u64);
+		if (index < 0) {
+			continue;
+		}
+
+		struct pollfd* pfd = &list->pollfds[index];
+		pfd->revents = to_poll_events(state->events[i].events) & (pfd->events | POLLERR | POLLHUP);
+		if (pfd->revents) {
+			list->listeners[index](list, index);
+		}
+	}
+	return ready;
+}
+
+const SocketsBackend sockets_epoll_backend = {
+	.name = "epoll",
+	.zerocopy = true,
+	.init = epoll_init,
+	.free = epoll_free,
+	.add = epoll_add,
+	.update = epoll_update,
+	.remove = epoll_remove,
+	.dispatch = epoll_dispatch,
+	.accept = sockets_plain_accept,
+	.recv = sockets_plain_recv,
+	.send = sockets_plain_send,
+	.sendfile = sockets_plain_sendfile,
+	.close = sockets_plain_close
+};
+
+#endif
@@ -0,0 +1,130 @@
+#include <errno.h>
+
+#include "utils.h"
+#include "net.h"
+#include "console.h"
+
+// the poll backend hands a packed array of pollfds to the kernel on every call and then
+// scans it for activity, simple and portable but O(sockets) per wakeup.  Removed sockets
+// leave a hole, which poll ignores, and the array is packed again before the next call
+
+typedef struct {
+	struct pollfd* fds;
+	size_t* slots; // index in the list of each pollfd
+	size_t size;
+	size_t count;
+	size_t holes;
+
+	size_t* positions; // where each index in the list is in fds
+	size_t positions_size;
+} PollState;
+
+static bool poll_init(Sockets* list) {
+	PollState* state = allocate(NULL, sizeof(*state));
+	state->size = 8;
+	state->count = 0;
+	state->holes = 0;
+	state->fds = allocate(NULL, sizeof(*state->fds) * state->size);
+	state->slots = allocate(NULL, sizeof(*state->slots) * state->size);
+	state->positions_size = 8;
+	state->positions = allocate(NULL, sizeof(*state->positions) * state->positions_size);
+
+	list->backend_state = state;
+	return true;
+}
+
+static void poll_free(Sockets* list) {
+	PollState* state = list->backend_state;
+	if (state != NULL) {
+		free(state->fds);
+		free(state->slots);
+		free(state->positions);
+		free(state);
+		list->backend_state = NULL;
+	}
+}
+
+static void poll_add(Sockets* list, size_t index) {
+	PollState* state = list->backend_state;
+	if (state->count == state->size) {
+		state->size *= 2;
+		state->fds = allocate(state->fds, sizeof(*state->fds) * state->size);
+		state->slots = allocate(state->slots, sizeof(*state->slots) * state->size);
+	}
+	if (index >= state->positions_size) {
+		state->positions_size = list->size;
+		state->positions = allocate(state->positions, sizeof(*state->positions) * state->positions_size);
+	}
+
+	state->fds[state->count] = list->pollfds[index];
+	state->slots[state->count] = index;
+	state->positions[index] = state->count;
+	state->count++;
+}
+
+static void poll_update(Sockets* list, size_t index) {
+	PollState* state = list->backend_state;
+	state->fds[state->positions[index]].events = list->pollfds[index].events;
+}
+
+static void poll_remove(Sockets* list, size_t index) {
+	PollState* state = list->backend_state;
+	size_t position = state->positions[index];
+	state->fds[position].fd = -1;
+	state->fds[position].revents = 0;
+	state->holes++;
+}
+
+// close up the holes left by removed sockets, keeping the order
+static void pack(PollState* state) {
+	size_t to = 0;
+	for (size_t from = 0; from < state->count; from++) {
+		if (state->fds[from].fd >= 0) {
+			state->fds[to] = state->fds[from];
+			state->slots[to] = state->slots[from];
+			state->positions[state->slots[to]] = to;
+			to++;
+		}
+	}
+	state->count = to;
+	state->holes = 0;
+}
+
+static int poll_dispatch(Sockets* list, int timeout) {
+	PollState* state = list->backend_state;
+	if (state->holes > 0) {
+		pack(state);
+	}
+
+	int ready = poll(state->fds, state->count, timeout);
+	if (ready < 0) {
+		return errno == EINTR ? 0 : -1;
+	}
+
+	// sockets added by listeners go on the end and wait for the next call
+	size_t count = state->count;
+	for (size_t i = 0; i < count; i++) {
+		if (state->fds[i].fd >= 0 && state->fds[i].revents) {
+			size_t index = state->slots[i];
+			list->pollfds[index].revents = state->fds[i].revents;
+			list->listeners[index](list, index);
+		}
+	}
+	return ready;
+}
+
+const SocketsBackend sockets_poll_backend = {
+	.name = "poll",
+	.zerocopy = true,
+	.init = poll_init,
+	.free = poll_free,
+	.add = poll_add,
+	.update = poll_update,
+	.remove = poll_remove,
+	.dispatch = poll_dispatch,
+	.accept = sockets_plain_accept,
+	.recv = sockets_plain_recv,
+	.send = sockets_plain_send,
+	.sendfile = sockets_plain_sendfile,
+	.close = sockets_plain_close
+};
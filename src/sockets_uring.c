@@ -0,0 +1,807 @@
+#ifdef __linux__
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/sendfile.h>
+#include <linux/io_uring.h>
+
+#include "utils.h"
+#include "net.h"
+#include "console.h"
+
+// the io_uring backend does the I/O itself rather than waiting for readiness.  Server sockets
+// get a multishot accept, client sockets receive into a ring of provided buffers and sends are
+// submitted as one sendmsg per call (batch, headers and content).  Anything else, and the first
+// read from a new socket, falls back to a oneshot poll, and files go out with a plain sendfile.
+// Submitting and waiting is a single io_uring_enter per loop, so there are no extra system
+// calls per I/O.
+// Completions are parked on the socket until its listener asks for them through the usual
+// accept/recv/send calls, which is how the existing listeners work unchanged.
+
+#define URING_ENTRIES 256
+#define URING_BUFFERS 256 // must be a power of 2
+#define URING_BUFFER_SIZE 4096
+#define URING_BUFFER_GROUP 0
+
+// the operation is kept in the low bits of the user data, the rest is the socket pointer
+#define OP_NONE 0
+#define OP_POLL 1
+#define OP_ACCEPT 2
+#define OP_RECV 3
+#define OP_SEND 4
+#define OP_MASK 7
+
+typedef struct {
+	int fd;
+	long index; // -1 once removed from the list
+	int inflight; // submitted operations that have not completed
+	short revents;
+	bool queued; // on the ready list
+	bool starved; // waiting for a free buffer
+
+	bool accepts;
+	bool streams;
+	bool non_blocking; // for sendfile
+	bool poll_armed;
+	bool accept_armed;
+	bool accept_cancelling;
+	bool recv_armed;
+
+	// received data waiting to be read
+	int recv_buf;
+	size_t recv_len;
+	size_t recv_offset;
+	bool recv_eof;
+	int recv_errno;
+
+	// accepted sockets waiting to be taken
+	int* accepted;
+	size_t accepted_size;
+	size_t accepted_start;
+	size_t accepted_count;
+
+	// send in progress, the buffers are kept until it's done
+	bool send_armed;
+	struct msghdr send_msg;
+	struct iovec send_iov[SOCKETS_MAX_IOV];
+	bool send_complete;
+	ssize_t send_result;
+	int send_errno;
+} UringSocket;
+
+typedef struct {
+	int ring_fd;
+
+	void* sq_ring;
+	size_t sq_ring_size;
+	unsigned* sq_head;
+	unsigned* sq_tail;
+	unsigned* sq_mask;
+	unsigned* sq_array;
+	unsigned sq_entries;
+	unsigned sq_local_tail;
+	struct io_uring_sqe* sqes;
+	size_t sqes_size;
+
+	void* cq_ring;
+	size_t cq_ring_size;
+	unsigned* cq_head;
+	unsigned* cq_tail;
+	unsigned* cq_mask;
+	struct io_uring_cqe* cqes;
+
+	struct io_uring_buf_ring* buf_ring;
+	size_t buf_ring_size;
+	char* buffers;
+	unsigned short buf_tail;
+
+	UringSocket** sockets;
+	size_t sockets_size;
+
+	UringSocket** ready;
+	size_t ready_size;
+	size_t ready_count;
+
+	UringSocket** starved;
+	size_t starved_size;
+	size_t starved_count;
+} UringState;
+
+// ================ ring ================
+static int uring_setup(unsigned entries, struct io_uring_params* params) {
+	return syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int uring_register(int fd, unsigned opcode, void* arg, unsigned count) {
+	return syscall(__NR_io_uring_register, fd, opcode, arg, count);
+}
+
+static int uring_enter(UringState* state, unsigned min_complete, int timeout) {
+	__atomic_store_n(state->sq_tail, state->sq_local_tail, __ATOMIC_RELEASE);
+	unsigned to_submit = state->sq_local_tail - __atomic_load_n(state->sq_head, __ATOMIC_ACQUIRE);
+
+	unsigned flags = 0;
+	struct io_uring_getevents_arg arg;
+	struct __kernel_timespec ts;
+	memset(&arg, 0, sizeof(arg));
+
+	if (min_complete > 0) {
+		flags |= IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG;
+		if (timeout >= 0) {
+			ts.tv_sec = timeout / 1000;
+			ts.tv_nsec = (timeout % 1000) * 1000000L;
+			arg.ts = (unsigned long)&ts;
+		}
+	}
+
+	if (to_submit == 0 && min_complete == 0) {
+		return 0;
+	}
+	return syscall(__NR_io_uring_enter, state->ring_fd, to_submit, min_complete, flags, flags & IORING_ENTER_EXT_ARG ? &arg : NULL, sizeof(arg));
+}
+
+// get the next free submission, reserving room for the rest of a linked chain
+static struct io_uring_sqe* get_sqe(UringState* state, unsigned chain) {
+	unsigned head = __atomic_load_n(state->sq_head, __ATOMIC_ACQUIRE);
+	if (state->sq_local_tail - head + chain > state->sq_entries) {
+		if (uring_enter(state, 0, 0) < 0) {
+			PANIC("submitting to io_uring");
+		}
+		head = __atomic_load_n(state->sq_head, __ATOMIC_ACQUIRE);
+		if (state->sq_local_tail - head + chain > state->sq_entries) {
+			PANIC("io_uring submission queue full");
+		}
+	}
+
+	unsigned slot = state->sq_local_tail & *state->sq_mask;
+	struct io_uring_sqe* sqe = &state->sqes[slot];
+	memset(sqe, 0, sizeof(*sqe));
+	state->sq_array[slot] = slot;
+	state->sq_local_tail++;
+	return sqe;
+}
+
+static struct io_uring_sqe* get_socket_sqe(UringState* state, UringSocket* sock, int op, unsigned chain) {
+	struct io_uring_sqe* sqe = get_sqe(state, chain);
+	sqe->fd = sock->fd;
+	sqe->user_data = (unsigned long)sock | op;
+	sock->inflight++;
+	return sqe;
+}
+
+// ================ provided buffers ================
+static char* buffer_ptr(UringState* state, int id) {
+	return state->buffers + (size_t)id * URING_BUFFER_SIZE;
+}
+
+static void arm(Sockets* list, UringState* state, UringSocket* sock);
+
+static void recycle_buffer(Sockets* list, UringState* state, int id) {
+	struct io_uring_buf* buf = &state->buf_ring->bufs[state->buf_tail & (URING_BUFFERS - 1)];
+	buf->addr = (unsigned long)buffer_ptr(state, id);
+	buf->len = URING_BUFFER_SIZE;
+	buf->bid = id;
+	state->buf_tail++;
+	__atomic_store_n(&state->buf_ring->tail, state->buf_tail, __ATOMIC_RELEASE);
+
+	// a socket that went without can try again
+	while (state->starved_count > 0) {
+		UringSocket* sock = state->starved[--state->starved_count];
+		sock->starved = false;
+		if (sock->index >= 0) {
+			arm(list, state, sock);
+			break;
+		}
+	}
+}
+
+static void add_starved(UringState* state, UringSocket* sock) {
+	if (!sock->starved) {
+		if (state->starved_count == state->starved_size) {
+			state->starved_size *= 2;
+			state->starved = allocate(state->starved, sizeof(*state->starved) * state->starved_size);
+		}
+		state->starved[state->starved_count++] = sock;
+		sock->starved = true;
+	}
+}
+
+// ================ sockets ================
+static UringSocket* get_socket(Sockets* list, size_t index) {
+	return ((UringState*)list->backend_state)->sockets[index];
+}
+
+static void free_socket(UringState* state, UringSocket* sock) {
+	// anything on the starved list is skipped once removed, but it must not be freed under it
+	for (size_t i=0; i<state->starved_count; i++) {
+		if (state->starved[i] == sock) {
+			state->starved[i] = state->starved[--state->starved_count];
+			break;
+		}
+	}
+	free(sock->accepted);
+	free(sock);
+}
+
+// free a removed socket once the kernel and the ready list are done with it
+static void release_socket(UringState* state, UringSocket* sock) {
+	if (sock->index < 0 && sock->inflight == 0 && !sock->queued) {
+		free_socket(state, sock);
+	}
+}
+
+static void queue_ready(UringState* state, UringSocket* sock, short revents) {
+	sock->revents |= revents;
+	if (!sock->queued) {
+		if (state->ready_count == state->ready_size) {
+			state->ready_size *= 2;
+			state->ready = allocate(state->ready, sizeof(*state->ready) * state->ready_size);
+		}
+		state->ready[state->ready_count++] = sock;
+		sock->queued = true;
+	}
+}
+
+// submit whatever the socket needs for the events its listener wants, and report anything
+// that has already completed
+static void arm(Sockets* list, UringState* state, UringSocket* sock) {
+	short events = list->pollfds[sock->index].events;
+
+	if (sock->accepts) {
+		if (events & POLLIN) {
+			if (sock->accepted_count > 0) {
+				queue_ready(state, sock, POLLIN);
+			} else if (!sock->accept_armed) {
+				struct io_uring_sqe* sqe = get_socket_sqe(state, sock, OP_ACCEPT, 1);
+				sqe->opcode = IORING_OP_ACCEPT;
+				sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+				sqe->accept_flags = SOCK_CLOEXEC;
+				sock->accept_armed = true;
+			}
+		} else if (sock->accept_armed && !sock->accept_cancelling) {
+			// stop accepting, connections wait in the kernel's backlog instead
+			struct io_uring_sqe* sqe = get_sqe(state, 1);
+			sqe->opcode = IORING_OP_ASYNC_CANCEL;
+			sqe->addr = (unsigned long)sock | OP_ACCEPT;
+			sqe->user_data = OP_NONE;
+			sock->accept_cancelling = true;
+		}
+		return;
+	}
+
+	if (sock->streams) {
+		if (events & POLLIN) {
+			if (sock->recv_buf >= 0 || sock->recv_eof || sock->recv_errno) {
+				queue_ready(state, sock, POLLIN);
+			} else if (!sock->recv_armed && !sock->starved) {
+				struct io_uring_sqe* sqe = get_socket_sqe(state, sock, OP_RECV, 1);
+				sqe->opcode = IORING_OP_RECV;
+				sqe->flags = IOSQE_BUFFER_SELECT;
+				sqe->buf_group = URING_BUFFER_GROUP;
+				sock->recv_armed = true;
+			}
+		}
+		if (events & POLLOUT) {
+			if (sock->send_complete) {
+				queue_ready(state, sock, POLLOUT);
+			} else if (!sock->send_armed && !sock->poll_armed) {
+				struct io_uring_sqe* sqe = get_socket_sqe(state, sock, OP_POLL, 1);
+				sqe->opcode = IORING_OP_POLL_ADD;
+				sqe->poll32_events = POLLOUT;
+				sock->poll_armed = true;
+			}
+		}
+		return;
+	}
+
+	if (events && !sock->poll_armed) {
+		struct io_uring_sqe* sqe = get_socket_sqe(state, sock, OP_POLL, 1);
+		sqe->opcode = IORING_OP_POLL_ADD;
+		sqe->poll32_events = events;
+		sock->poll_armed = true;
+	}
+}
+
+static void complete(Sockets* list, UringState* state, struct io_uring_cqe* cqe) {
+	int op = cqe->user_data & OP_MASK;
+	UringSocket* sock = (UringSocket*)(unsigned long)(cqe->user_data & ~(unsigned long long)OP_MASK);
+	if (op == OP_NONE) {
+		return;
+	}
+
+	bool removed = sock->index < 0;
+	bool more = cqe->flags & IORING_CQE_F_MORE;
+	if (!more) {
+		sock->inflight--;
+	}
+
+	switch (op) {
+		case OP_POLL:
+			sock->poll_armed = false;
+			if (!removed && cqe->res > 0) {
+				queue_ready(state, sock, cqe->res);
+			}
+			break;
+
+		case OP_ACCEPT:
+			if (!more) {
+				sock->accept_armed = false;
+				if (sock->accept_cancelling) {
+					sock->accept_cancelling = false;
+					if (!removed) {
+						queue_ready(state, sock, 0); // re-arm if wanted again
+					}
+				}
+			}
+			if (cqe->res >= 0) {
+				if (removed) {
+					close(cqe->res);
+					break;
+				}
+				if (sock->accepted_start + sock->accepted_count == sock->accepted_size) {
+					sock->accepted_size = sock->accepted_size ? sock->accepted_size * 2 : 8;
+					sock->accepted = allocate(sock->accepted, sizeof(*sock->accepted) * sock->accepted_size);
+				}
+				sock->accepted[sock->accepted_start + sock->accepted_count++] = cqe->res;
+				queue_ready(state, sock, POLLIN);
+			} else if (cqe->res != -ECANCELED && !removed) {
+				errno = -cqe->res;
+				ERROR("io_uring accept");
+				queue_ready(state, sock, 0); // re-arm
+			}
+			break;
+
+		case OP_RECV: {
+			sock->recv_armed = false;
+			int id = (cqe->flags & IORING_CQE_F_BUFFER) ? (int)(cqe->flags >> IORING_CQE_BUFFER_SHIFT) : -1;
+			if (removed || cqe->res <= 0) {
+				if (id >= 0) {
+					recycle_buffer(list, state, id);
+				}
+			}
+			if (removed) {
+				break;
+			}
+			if (cqe->res > 0) {
+				sock->recv_buf = id;
+				sock->recv_len = cqe->res;
+				sock->recv_offset = 0;
+				queue_ready(state, sock, POLLIN);
+			} else if (cqe->res == 0) {
+				sock->recv_eof = true;
+				queue_ready(state, sock, POLLIN);
+			} else if (cqe->res == -ENOBUFS) {
+				add_starved(state, sock);
+			} else if (cqe->res != -ECANCELED) {
+				sock->recv_errno = -cqe->res;
+				queue_ready(state, sock, POLLIN);
+			}
+			break;
+		}
+
+		case OP_SEND:
+			sock->send_armed = false;
+			if (cqe->res >= 0) {
+				sock->send_result = cqe->res;
+			} else {
+				sock->send_errno = -cqe->res;
+			}
+			sock->send_complete = true;
+			if (!removed) {
+				queue_ready(state, sock, POLLOUT);
+			}
+			break;
+	}
+
+	if (removed) {
+		release_socket(state, sock);
+	}
+}
+
+// ================ backend ================
+static void uring_free(Sockets* list);
+
+static bool uring_init(Sockets* list) {
+	UringState* state = allocate(NULL, sizeof(*state));
+	memset(state, 0, sizeof(*state));
+	state->ring_fd = -1;
+	list->backend_state = state;
+
+	// set up the ring, the newer flags are only hints so try without them
+	struct io_uring_params params;
+	memset(&params, 0, sizeof(params));
+	params.flags = IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_COOP_TASKRUN;
+	state->ring_fd = uring_setup(URING_ENTRIES, &params);
+	if (state->ring_fd < 0 && errno == EINVAL) {
+		memset(&params, 0, sizeof(params));
+		state->ring_fd = uring_setup(URING_ENTRIES, &params);
+	}
+	if (state->ring_fd < 0) {
+		ERROR("io_uring_setup");
+		uring_free(list);
+		return false;
+	}
+	if (!(params.features & IORING_FEAT_EXT_ARG)) {
+		ERROR("io_uring is too old, no timeouts on wait");
+		uring_free(list);
+		return false;
+	}
+
+	state->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+	state->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+	if (params.features & IORING_FEAT_SINGLE_MMAP) {
+		if (state->cq_ring_size > state->sq_ring_size) {
+			state->sq_ring_size = state->cq_ring_size;
+		}
+		state->cq_ring_size = 0;
+	}
+
+	state->sq_ring = mmap(NULL, state->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, state->ring_fd, IORING_OFF_SQ_RING);
+	if (state->sq_ring == MAP_FAILED) {
+		state->sq_ring = NULL;
+		ERROR("mapping io_uring submission queue");
+		uring_free(list);
+		return false;
+	}
+	if (state->cq_ring_size > 0) {
+		state->cq_ring = mmap(NULL, state->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, state->ring_fd, IORING_OFF_CQ_RING);
+		if (state->cq_ring == MAP_FAILED) {
+			state->cq_ring = NULL;
+			ERROR("mapping io_uring completion queue");
+			uring_free(list);
+			return false;
+		}
+	} else {
+		state->cq_ring = state->sq_ring;
+	}
+	state->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+	state->sqes = mmap(NULL, state->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, state->ring_fd, IORING_OFF_SQES);
+	if (state->sqes == MAP_FAILED) {
+		state->sqes = NULL;
+		ERROR("mapping io_uring submissions");
+		uring_free(list);
+		return false;
+	}
+
+	char* sq = state->sq_ring;
+	state->sq_head = (unsigned*)(sq + params.sq_off.head);
+	state->sq_tail = (unsigned*)(sq + params.sq_off.tail);
+	state->sq_mask = (unsigned*)(sq + params.sq_off.ring_mask);
+	state->sq_array = (unsigned*)(sq + params.sq_off.array);
+	state->sq_entries = params.sq_entries;
+	state->sq_local_tail = *state->sq_tail;
+
+	char* cq = state->cq_ring;
+	state->cq_head = (unsigned*)(cq + params.cq_off.head);
+	state->cq_tail = (unsigned*)(cq + params.cq_off.tail);
+	state->cq_mask = (unsigned*)(cq + params.cq_off.ring_mask);
+	state->cqes = (struct io_uring_cqe*)(cq + params.cq_off.cqes);
+
+	// register a ring of provided buffers for receiving into
+	state->buf_ring_size = URING_BUFFERS * sizeof(struct io_uring_buf);
+	state->buf_ring = mmap(NULL, state->buf_ring_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (state->buf_ring == MAP_FAILED) {
+		state->buf_ring = NULL;
+		ERROR("mapping io_uring buffer ring");
+		uring_free(list);
+		return false;
+	}
+
+	struct io_uring_buf_reg reg;
+	memset(&reg, 0, sizeof(reg));
+	reg.ring_addr = (unsigned long)state->buf_ring;
+	reg.ring_entries = URING_BUFFERS;
+	reg.bgid = URING_BUFFER_GROUP;
+	if (uring_register(state->ring_fd, IORING_REGISTER_PBUF_RING, &reg, 1) != 0) {
+		ERROR("registering io_uring buffer ring");
+		uring_free(list);
+		return false;
+	}
+
+	state->buffers = allocate(NULL, (size_t)URING_BUFFERS * URING_BUFFER_SIZE);
+	state->buf_tail = 0;
+	for (int i=0; i<URING_BUFFERS; i++) {
+		recycle_buffer(list, state, i);
+	}
+
+	state->sockets_size = list->size;
+	state->sockets = allocate(NULL, sizeof(*state->sockets) * state->sockets_size);
+	state->ready_size = list->max_events;
+	state->ready = allocate(NULL, sizeof(*state->ready) * state->ready_size);
+	state->starved_size = 8;
+	state->starved = allocate(NULL, sizeof(*state->starved) * state->starved_size);
+
+	return true;
+}
+
+static void uring_free(Sockets* list) {
+	UringState* state = list->backend_state;
+	if (state == NULL) {
+		return;
+	}
+
+	// closing the ring cancels anything in flight
+	if (state->ring_fd >= 0) {
+		close(state->ring_fd);
+	}
+	if (state->sqes != NULL) {
+		munmap(state->sqes, state->sqes_size);
+	}
+	if (state->cq_ring != NULL && state->cq_ring != state->sq_ring) {
+		munmap(state->cq_ring, state->cq_ring_size);
+	}
+	if (state->sq_ring != NULL) {
+		munmap(state->sq_ring, state->sq_ring_size);
+	}
+	if (state->buf_ring != NULL) {
+		munmap(state->buf_ring, state->buf_ring_size);
+	}
+	free(state->buffers);
+
+	for (size_t i=0; i<list->high && state->sockets != NULL; i++) {
+		if (state->sockets[i] != NULL) {
+			free_socket(state, state->sockets[i]);
+		}
+	}
+	free(state->sockets);
+	free(state->ready);
+	free(state->starved);
+	free(state);
+	list->backend_state = NULL;
+}
+
+static void uring_add(Sockets* list, size_t index) {
+	UringState* state = list->backend_state;
+	if (state->sockets_size < list->size) {
+		state->sockets_size = list->size;
+		state->sockets = allocate(state->sockets, sizeof(*state->sockets) * state->sockets_size);
+	}
+
+	UringSocket* sock = allocate(NULL, sizeof(*sock));
+	memset(sock, 0, sizeof(*sock));
+	sock->fd = list->pollfds[index].fd;
+	sock->index = index;
+	sock->recv_buf = -1;
+	state->sockets[index] = sock;
+
+	arm(list, state, sock);
+}
+
+static void uring_update(Sockets* list, size_t index) {
+	arm(list, list->backend_state, get_socket(list, index));
+}
+
+static void uring_remove(Sockets* list, size_t index) {
+	UringState* state = list->backend_state;
+	UringSocket* sock = state->sockets[index];
+
+	if (sock->recv_buf >= 0) {
+		recycle_buffer(list, state, sock->recv_buf);
+		sock->recv_buf = -1;
+	}
+	for (size_t i=0; i<sock->accepted_count; i++) {
+		close(sock->accepted[sock->accepted_start + i]);
+	}
+	sock->accepted_count = 0;
+
+	sock->index = -1;
+	state->sockets[index] = NULL;
+	release_socket(state, sock);
+}
+
+static int uring_dispatch(Sockets* list, int timeout) {
+	UringState* state = list->backend_state;
+
+	// submit and wait in one go
+	if (uring_enter(state, 1, timeout) < 0) {
+		if (errno != EINTR && errno != ETIME && errno != EBUSY) {
+			return -1;
+		}
+	}
+
+	// collect completions
+	unsigned head = *state->cq_head;
+	unsigned tail = __atomic_load_n(state->cq_tail, __ATOMIC_ACQUIRE);
+	int completions = tail - head;
+	while (head != tail) {
+		complete(list, state, &state->cqes[head & *state->cq_mask]);
+		head++;
+	}
+	__atomic_store_n(state->cq_head, head, __ATOMIC_RELEASE);
+
+	// call the listeners, which can add to the ready list as they go
+	for (size_t i=0; i<state->ready_count; i++) {
+		UringSocket* sock = state->ready[i];
+		if (sock->index < 0) {
+			continue;
+		}
+
+		struct pollfd* pfd = &list->pollfds[sock->index];
+		pfd->revents = sock->revents & (pfd->events | POLLERR | POLLHUP | POLLNVAL);
+		sock->revents = 0;
+		if (pfd->revents) {
+			list->listeners[sock->index](list, sock->index);
+		}
+
+		if (sock->index >= 0) {
+			arm(list, state, sock);
+		}
+	}
+
+	for (size_t i=0; i<state->ready_count; i++) {
+		state->ready[i]->queued = false;
+		release_socket(state, state->ready[i]);
+	}
+	state->ready_count = 0;
+
+	return completions;
+}
+
+static int uring_accept(Sockets* list, size_t index, struct sockaddr* address, socklen_t* address_size) {
+	UringSocket* sock = get_socket(list, index);
+
+	if (!sock->accepts) {
+		sock->accepts = true;
+		arm(list, list->backend_state, sock);
+	}
+
+	if (sock->accepted_count == 0) {
+		sock->accepted_start = 0;
+		errno = EAGAIN;
+		return -1;
+	}
+
+	int client_socket = sock->accepted[sock->accepted_start++];
+	sock->accepted_count--;
+
+	// multishot accept can't fill in addresses
+	if (getpeername(client_socket, address, address_size) != 0) {
+		memset(address, 0, *address_size);
+	}
+	return client_socket;
+}
+
+static ssize_t uring_recv(Sockets* list, size_t index, void* buf, size_t len) {
+	UringState* state = list->backend_state;
+	UringSocket* sock = get_socket(list, index);
+
+	// the first read follows a poll, so the data is there to take directly
+	if (!sock->streams) {
+		sock->streams = true;
+		return recv(sock->fd, buf, len, MSG_DONTWAIT);
+	}
+
+	if (sock->recv_buf >= 0) {
+		size_t n = sock->recv_len - sock->recv_offset;
+		if (n > len) {
+			n = len;
+		}
+		memcpy(buf, buffer_ptr(state, sock->recv_buf) + sock->recv_offset, n);
+		sock->recv_offset += n;
+		if (sock->recv_offset == sock->recv_len) {
+			recycle_buffer(list, state, sock->recv_buf);
+			sock->recv_buf = -1;
+		}
+		return n;
+	}
+	if (sock->recv_eof) {
+		return 0;
+	}
+	if (sock->recv_errno) {
+		errno = sock->recv_errno;
+		sock->recv_errno = 0;
+		return -1;
+	}
+
+	arm(list, state, sock);
+	errno = EAGAIN;
+	return -1;
+}
+
+static ssize_t uring_send(Sockets* list, size_t index, const struct iovec* iov, int count) {
+	UringState* state = list->backend_state;
+	UringSocket* sock = get_socket(list, index);
+	sock->streams = true;
+
+	// report a finished send
+	if (sock->send_complete) {
+		sock->send_complete = false;
+		if (sock->send_result == 0 && sock->send_errno != 0) {
+			errno = sock->send_errno;
+			return -1;
+		}
+		return sock->send_result;
+	}
+	if (sock->send_armed) {
+		errno = EAGAIN;
+		return -1;
+	}
+
+	int parts = 0;
+	for (int i=0; i<count && parts<SOCKETS_MAX_IOV; i++) {
+		if (iov[i].iov_len > 0) {
+			sock->send_iov[parts++] = iov[i];
+		}
+	}
+	if (parts == 0) {
+		return 0;
+	}
+
+	// the whole list in one sendmsg, waiting for all of it unless there's an error
+	memset(&sock->send_msg, 0, sizeof(sock->send_msg));
+	sock->send_msg.msg_iov = sock->send_iov;
+	sock->send_msg.msg_iovlen = parts;
+	sock->send_result = 0;
+	sock->send_errno = 0;
+
+	struct io_uring_sqe* sqe = get_socket_sqe(state, sock, OP_SEND, 1);
+	sqe->opcode = IORING_OP_SENDMSG;
+	sqe->addr = (unsigned long)&sock->send_msg;
+	sqe->len = 1;
+	sqe->msg_flags = MSG_NOSIGNAL | MSG_WAITALL;
+	sock->send_armed = true;
+
+	errno = EAGAIN;
+	return -1;
+}
+
+// there's no sendfile op, so it's the system call there and then as the readiness backends
+// do it, once the socket is made non-blocking.  Not while a send is still going
+static ssize_t uring_sendfile(Sockets* list, size_t index, int fd, off_t* offset, size_t count) {
+	UringSocket* sock = get_socket(list, index);
+	if (sock->send_armed || sock->send_complete) {
+		errno = EAGAIN;
+		return -1;
+	}
+	if (!sock->non_blocking) {
+		if (!set_non_blocking(sock->fd)) {
+			return -1;
+		}
+		sock->non_blocking = true;
+	}
+	return sendfile(sock->fd, fd, offset, count);
+}
+
+// anything in flight holds the socket open, so cancel it and close behind the cancel
+static void uring_close(Sockets* list, size_t index) {
+	UringState* state = list->backend_state;
+	UringSocket* sock = get_socket(list, index);
+
+	if (sock->inflight == 0) {
+		close(sock->fd);
+		return;
+	}
+
+	struct io_uring_sqe* sqe = get_sqe(state, 2);
+	sqe->opcode = IORING_OP_ASYNC_CANCEL;
+	sqe->fd = sock->fd;
+	sqe->cancel_flags = IORING_ASYNC_CANCEL_FD | IORING_ASYNC_CANCEL_ALL;
+	sqe->flags = IOSQE_IO_HARDLINK;
+	sqe->user_data = OP_NONE;
+
+	sqe = get_sqe(state, 1);
+	sqe->opcode = IORING_OP_CLOSE;
+	sqe->fd = sock->fd;
+	sqe->user_data = OP_NONE;
+}
+
+const SocketsBackend sockets_uring_backend = {
+	.name = "io_uring",
+	.init = uring_init,
+	.free = uring_free,
+	.add = uring_add,
+	.update = uring_update,
+	.remove = uring_remove,
+	.dispatch = uring_dispatch,
+	.accept = uring_accept,
+	.recv = uring_recv,
+	.send = uring_send,
+	.sendfile = uring_sendfile,
+	.close = uring_close
+};
+
+#endif
\ No newline at end of file
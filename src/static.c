@@ -1,107 +1,243 @@
+#define _POSIX_C_SOURCE 200809L
+
 #include <sys/stat.h>
 #include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
 
 #include "static.h"
 #include "console.h"
 
-bool static_content(void* state, Request* request, Response* response) {
-	(void)state; //un-used
+// what a worker finds out about a file, path has room for "/index.html" on the end.  A small
+// file being sent is read straight into the response's body, a big one is opened for
+// sendfile.  With a URI cache the directory is
+// watched, so what was found can be noted and not looked up again until it changes
+struct static_lookup {
+	bool get;
+	bool found;
+	bool index;
+	bool read;
+	int file;
+	struct stat attrib;
+	time_t if_modified_since;
+	Buffer* body;
+	UriCache* cache;
+	bool watched;
+	size_t path_len;
+	char path[];
+};
+
+// what's kept between requests, see content_note
+struct static_note {
+	mode_t mode;
+	time_t mtime;
+	off_t size;
+	bool index;
+};
+
+static char* last_segment(Request* request) {
+	char* segment = request->target->segments[request->target->segments_count-1];
+	return strlen(segment)==0 ? "index.html" : segment;
+}
+
+// small files are read, big ones opened and sent as they are when the response goes
+static void load_file(struct static_lookup* lookup) {
+	if (lookup->attrib.st_size < STATIC_SENDFILE_MIN) {
+		lookup->read = buf_append_file(lookup->body, lookup->path);
+		return;
+	}
 
-	TRACE("checking static content");
+	lookup->file = open(lookup->path, O_RDONLY | O_CLOEXEC);
+	if (lookup->file < 0) {
+		return;
+	}
+	// what's sent is what's described
+	if (fstat(lookup->file, &lookup->attrib) != 0) {
+		close(lookup->file);
+		lookup->file = -1;
+		return;
+	}
+	lookup->read = true;
+}
 
-	// build a local path
-	char local_path[request->target->path_len + 1 + 11 + 1]; // 1 for leading dot, 11 for possible /index.html, 1 for null terminator
-	local_path[0] = '.';
-	strcpy(local_path + 1, request->target->path);
+// watch the directory holding the path before looking, so no change is missed
+static void watch(struct static_lookup* lookup) {
+	if (lookup->cache == NULL) {
+		return;
+	}
+	char* slash = strrchr(lookup->path, '/');
+	*slash = '\0';
+	lookup->watched = uri_cache_watch(lookup->cache, lookup->path);
+	*slash = '/';
+}
+
+// on a worker thread, everything that can block on the disk
+static void find_file(void* arg) {
+	struct static_lookup* lookup = arg;
+
+	watch(lookup);
+	lookup->found = stat(lookup->path, &lookup->attrib) == 0;
+	if (!lookup->found) {
+		return;
+	}
 
-	char* last_segment = request->target->segments[request->target->segments_count-1];
+	if (S_ISREG(lookup->attrib.st_mode)) {
+		// only read what will be sent
+		if (!lookup->get || (lookup->if_modified_since>0 && lookup->if_modified_since>=lookup->attrib.st_mtime)) {
+			return;
+		}
+		load_file(lookup);
 
-	if (strlen(last_segment)==0) {
-		last_segment = "index.html";
-		strcpy(local_path + 1 + request->target->path_len, last_segment);
+	} else if (S_ISDIR(lookup->attrib.st_mode)) {
+		// check for index, in the directory itself
+		if (lookup->watched) {
+			lookup->watched = uri_cache_watch(lookup->cache, lookup->path);
+		}
+		struct stat index;
+		strcpy(lookup->path + 1 + lookup->path_len, "/index.html");
+		lookup->index = stat(lookup->path, &index) == 0 && S_ISREG(index.st_mode);
+		lookup->path[1 + lookup->path_len] = '\0';
 	}
-
-	// ignore dot files
-	if (last_segment[0]=='.') {
-		TRACE("ignoring dot file \"%s\"", local_path);
-		return false;
+}
+
+// on a worker thread, for a file noted last time
+static void read_file(void* arg) {
+	load_file(arg);
+}
+
+// back on the event loop with what the worker found, or what was noted last time
+static int respond(struct static_lookup* lookup, Request* request, Response* response) {
+	if (!lookup->found) {
+		TRACE("could not find \"%s\"", lookup->path);
+		return CONTENT_NOT_FOUND;
 	}
 
-	// get file information
-	struct stat attrib;
-	if (stat(local_path, &attrib) != 0) {
-		TRACE("could not find \"%s\"", local_path);
-		return false;
+	if (lookup->watched) {
+		struct static_note note = {
+			.mode = lookup->attrib.st_mode,
+			.mtime = lookup->attrib.st_mtime,
+			.size = lookup->attrib.st_size,
+			.index = lookup->index
+		};
+		content_note(request, &note, sizeof(note));
 	}
 
-	if (S_ISREG(attrib.st_mode)) {
-		TRACE("found \"%s\"", local_path);
+	if (S_ISREG(lookup->attrib.st_mode)) {
+		TRACE("found \"%s\"", lookup->path);
 
 		// check this is a GET or HEAD request
 		if (!token_is(request->method, "GET") && !token_is(request->method, "HEAD")) {
 			TRACE("method not allowed");
 			response_error(response, 405);
 			response_header(response, "Allow", "GET, HEAD");
-			return true;
+			return CONTENT_READY;
 		}
 
 		// check modified date
-		if (request->if_modified_since>0 && request->if_modified_since>=attrib.st_mtime) {
+		if (request->if_modified_since>0 && request->if_modified_since>=lookup->attrib.st_mtime) {
 			TRACE("not modified, use cached version");
 			response_status(response, 304);
-			return true;
+			return CONTENT_READY;
 		}
 
-		// open file and get content length
-		long length;
-		FILE *file = fopen(local_path, "rb");
-		
-		if (file == NULL) {
-			ERROR("unable to open file \"%s\"", local_path);
-			return false;
+		if (lookup->get && !lookup->read) {
+			ERROR("unable to open file \"%s\"", lookup->path);
+			return CONTENT_NOT_FOUND;
 		}
 
-		fseek(file, 0, SEEK_END);
-		length = ftell(file);
-		fseek(file, 0, SEEK_SET);
-
 		// respond
 		response_status(response, 200);
 		response_header(response, "Cache-Control", "no-cache");
-		response_date(response, "Last-Modified", attrib.st_mtime);
+		response_date(response, "Last-Modified", lookup->attrib.st_mtime);
 
-		char* ext = strrchr(last_segment, '.');
+		char* ext = strrchr(last_segment(request), '.');
 		if (token_is(request->method, "HEAD")) {
-			repsonse_content_headers(response, ext, length);
+			repsonse_content_headers(response, ext, lookup->attrib.st_size);
+		} else if (lookup->file >= 0) {
+			response_file(response, lookup->file, lookup->attrib.st_size, ext);
 		} else {
-			char* body = buf_reserve(response_content(response, ext), length);
-			fread(body, 1, length, file);
+			response_content(response, ext);
 		}
-		fclose(file);
-
-		return true;
+		return CONTENT_READY;
 
-	} else if (S_ISDIR(attrib.st_mode)) {
-		TRACE("found a directory \"%s\"", local_path);
+	} else if (S_ISDIR(lookup->attrib.st_mode)) {
+		TRACE("found a directory \"%s\"", lookup->path);
 
-		// check for index
-		strcpy(local_path + 1 + request->target->path_len, "/index.html");
-		if (stat(local_path, &attrib) == 0) {
-			if (S_ISREG(attrib.st_mode)) {
-				TRACE("found index, redirecting");
+		if (lookup->index) {
+			TRACE("found index, redirecting");
 
-				char new_path[request->target->path_len+2];
-				strcpy(new_path, request->target->path);
-				strcpy(new_path + request->target->path_len, "/");
+			char new_path[request->target->path_len+2];
+			strcpy(new_path, request->target->path);
+			strcpy(new_path + request->target->path_len, "/");
 
-				response_redirect(response, new_path);
-				return true;
-			}
+			response_redirect(response, new_path);
+			return CONTENT_READY;
 		}
 		TRACE("no index");
-		return false;
+		return CONTENT_NOT_FOUND;
 	} else {
-		ERROR("unknown file mode for \"%s\": %d", local_path, attrib.st_mode);
-		return false;
+		ERROR("unknown file mode for \"%s\": %d", lookup->path, lookup->attrib.st_mode);
+		return CONTENT_NOT_FOUND;
 	}
-}
\ No newline at end of file
+}
+
+// the file is looked up and read on a worker, then we're called again to answer
+int static_content(void* state, Request* request, Response* response) {
+	(void)state; //un-used
+
+	struct static_lookup* lookup = request->work_arg;
+	if (lookup != NULL) {
+		return respond(lookup, request, response);
+	}
+
+	TRACE("checking static content");
+
+	// build a local path
+	size_t path_len = request->target->path_len;
+	lookup = arena_alloc(request->arena, sizeof(*lookup) + path_len + 1 + 11 + 1); // 1 for leading dot, 11 for possible /index.html, 1 for null terminator
+	lookup->path[0] = '.';
+	strcpy(lookup->path + 1, request->target->path);
+
+	char* segment = request->target->segments[request->target->segments_count-1];
+	if (strlen(segment)==0) {
+		segment = "index.html";
+		strcpy(lookup->path + 1 + path_len, segment);
+	}
+
+	// ignore dot files
+	if (segment[0]=='.') {
+		TRACE("ignoring dot file \"%s\"", lookup->path);
+		return CONTENT_NOT_FOUND;
+	}
+
+	lookup->get = token_is(request->method, "GET");
+	lookup->found = false;
+	lookup->index = false;
+	lookup->read = false;
+	lookup->file = -1;
+	lookup->if_modified_since = request->if_modified_since;
+	lookup->body = response_body(response);
+	lookup->cache = request->uris;
+	lookup->watched = false;
+	lookup->path_len = path_len;
+
+	// found last time, and nothing has changed since
+	const struct static_note* note = content_recall(request, sizeof(*note));
+	if (note != NULL) {
+		TRACE("already found \"%s\"", lookup->path);
+		lookup->found = true;
+		lookup->index = note->index;
+		lookup->attrib.st_mode = note->mode;
+		lookup->attrib.st_mtime = note->mtime;
+		lookup->attrib.st_size = note->size;
+		lookup->watched = true;
+
+		// only a file being sent needs the disk
+		if (S_ISREG(note->mode) && lookup->get && (request->if_modified_since<=0 || request->if_modified_since<note->mtime)) {
+			return content_defer(request, read_file, lookup);
+		}
+		return respond(lookup, request, response);
+	}
+
+	return content_defer(request, find_file, lookup);
+}
@@ -4,7 +4,12 @@
 #include <stdbool.h>
 #include "request.h"
 #include "response.h"
+#include "content_generator.h"
 
-bool static_content(void* state, Request* request, Response* Response);
+// files smaller than this are read and sent along with the headers, bigger ones are sent
+// straight from the file a piece at a time
+#define STATIC_SENDFILE_MIN 65536
+
+int static_content(void* state, Request* request, Response* Response);
 
 #endif
\ No newline at end of file
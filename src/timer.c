@@ -0,0 +1,170 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <time.h>
+
+#include "timer.h"
+
+// Each level has TIMER_SLOTS slots, a slot on level 0 is one tick and a slot on each level above
+// covers a whole turn of the level below.  Timers are put in the lowest level that reaches their
+// expiry, and each time a level turns over the next slot of the level above is emptied and its
+// timers re-added lower down (cascaded), so they end up on level 0 in time to expire.
+
+#define SLOT_MASK (TIMER_SLOTS - 1)
+#define LEVEL_SPAN(level) (1UL << (TIMER_BITS * ((level) + 1)))
+#define MAX_TICKS (LEVEL_SPAN(TIMER_LEVELS - 1) - 1)
+
+static void list_init(Timer* head) {
+	head->next = head;
+	head->prev = head;
+}
+
+static bool list_empty(Timer* head) {
+	return head->next == head;
+}
+
+static void list_append(Timer* head, Timer* timer) {
+	timer->prev = head->prev;
+	timer->next = head;
+	head->prev->next = timer;
+	head->prev = timer;
+}
+
+static void list_unlink(Timer* timer) {
+	timer->prev->next = timer->next;
+	timer->next->prev = timer->prev;
+	timer->next = NULL;
+	timer->prev = NULL;
+}
+
+void timer_wheel_init(TimerWheel* wheel, unsigned long now) {
+	wheel->now = now / TIMER_TICK;
+	wheel->count = 0;
+	for (int level=0; level<TIMER_LEVELS; level++) {
+		for (int slot=0; slot<TIMER_SLOTS; slot++) {
+			list_init(&wheel->slots[level][slot]);
+		}
+	}
+}
+
+void timer_init(Timer* timer) {
+	timer->next = NULL;
+	timer->prev = NULL;
+	timer->expires = 0;
+}
+
+bool timer_active(Timer* timer) {
+	return timer->next != NULL;
+}
+
+static void insert(TimerWheel* wheel, Timer* timer) {
+	if ((long)(timer->expires - wheel->now) < 0) {
+		// already due, fire on the next tick
+		list_append(&wheel->slots[0][wheel->now & SLOT_MASK], timer);
+		return;
+	}
+
+	unsigned long delta = timer->expires - wheel->now;
+	if (delta > MAX_TICKS) {
+		delta = MAX_TICKS;
+		timer->expires = wheel->now + MAX_TICKS;
+	}
+
+	int level = 0;
+	while (level < TIMER_LEVELS-1 && delta >= LEVEL_SPAN(level)) {
+		level++;
+	}
+	list_append(&wheel->slots[level][(timer->expires >> (TIMER_BITS * level)) & SLOT_MASK], timer);
+}
+
+void timer_add(TimerWheel* wheel, Timer* timer, unsigned long now, unsigned long timeout) {
+	if (timer_active(timer)) {
+		timer_cancel(wheel, timer);
+	}
+
+	// an empty wheel may not have been advanced for a while, catch it up
+	if (wheel->count == 0) {
+		wheel->now = now / TIMER_TICK;
+	}
+
+	// round up so a timer never fires early
+	timer->expires = (now + timeout + TIMER_TICK - 1) / TIMER_TICK;
+	insert(wheel, timer);
+	wheel->count++;
+}
+
+void timer_cancel(TimerWheel* wheel, Timer* timer) {
+	if (timer_active(timer)) {
+		list_unlink(timer);
+		wheel->count--;
+	}
+}
+
+static void cascade(TimerWheel* wheel, int level, unsigned long slot) {
+	Timer* head = &wheel->slots[level][slot];
+	while (!list_empty(head)) {
+		Timer* timer = head->next;
+		list_unlink(timer);
+		insert(wheel, timer);
+	}
+}
+
+// milliseconds until the next timer could fire, or -1 for none
+int timer_wheel_next(TimerWheel* wheel, unsigned long now) {
+	if (wheel->count == 0) {
+		return -1;
+	}
+
+	// the next cascade might bring timers down that are due straight away
+	unsigned long next = (wheel->now + SLOT_MASK) & ~(unsigned long)SLOT_MASK;
+	for (unsigned long tick = wheel->now; tick < next; tick++) {
+		if (!list_empty(&wheel->slots[0][tick & SLOT_MASK])) {
+			next = tick;
+			break;
+		}
+	}
+
+	long wait = (long)(next * TIMER_TICK) - (long)now;
+	return wait > 0 ? (int)wait : 0;
+}
+
+void timer_wheel_advance(TimerWheel* wheel, unsigned long now, timer_callback callback, void* context) {
+	unsigned long target = now / TIMER_TICK;
+
+	while ((long)(target - wheel->now) >= 0) {
+		if (wheel->count == 0) {
+			wheel->now = target + 1;
+			return;
+		}
+
+		unsigned long slot = wheel->now & SLOT_MASK;
+		if (slot == 0) {
+			for (int level=1; level<TIMER_LEVELS; level++) {
+				unsigned long level_slot = (wheel->now >> (TIMER_BITS * level)) & SLOT_MASK;
+				cascade(wheel, level, level_slot);
+				if (level_slot != 0) {
+					break;
+				}
+			}
+		}
+		wheel->now++;
+
+		// callbacks may add and cancel timers, so take them one at a time
+		Timer* head = &wheel->slots[0][slot];
+		while (!list_empty(head)) {
+			Timer* timer = head->next;
+			list_unlink(timer);
+			wheel->count--;
+			callback(timer, context);
+		}
+	}
+}
+
+unsigned long timer_now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+#undef SLOT_MASK
+#undef LEVEL_SPAN
+#undef MAX_TICKS
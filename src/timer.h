@@ -0,0 +1,41 @@
+#ifndef TINN_TIMER_H
+#define TINN_TIMER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// a hierarchical timer wheel, adding, cancelling and expiring a timer are all O(1).
+// Times are in milliseconds and timers fire on a TIMER_TICK boundary.
+#define TIMER_TICK 10
+#define TIMER_BITS 6
+#define TIMER_SLOTS (1 << TIMER_BITS)
+#define TIMER_LEVELS 4
+
+typedef struct timer Timer;
+typedef void (*timer_callback)(Timer* timer, void* context);
+
+struct timer {
+	Timer* next;
+	Timer* prev;
+	unsigned long expires;
+};
+
+typedef struct {
+	unsigned long now; // in ticks
+	size_t count;
+	Timer slots[TIMER_LEVELS][TIMER_SLOTS];
+} TimerWheel;
+
+void timer_wheel_init(TimerWheel* wheel, unsigned long now);
+
+void timer_init(Timer* timer);
+bool timer_active(Timer* timer);
+void timer_add(TimerWheel* wheel, Timer* timer, unsigned long now, unsigned long timeout);
+void timer_cancel(TimerWheel* wheel, Timer* timer);
+
+int timer_wheel_next(TimerWheel* wheel, unsigned long now);
+void timer_wheel_advance(TimerWheel* wheel, unsigned long now, timer_callback callback, void* context);
+
+unsigned long timer_now();
+
+#endif
\ No newline at end of file
@@ -1,5 +1,12 @@
+#define _POSIX_C_SOURCE 200809L
+
 #include <stdlib.h>
 #include <string.h>
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/socket.h>
 
 #include "utils.h"
 #include "console.h"
@@ -7,16 +14,65 @@
 #include "blog.h"
 #include "static.h"
 #include "server.h"
+#include "upgrade.h"
 #include "version.h"
 
+#define DEFAULT_HEADER_TIMEOUT 10
+#define DEFAULT_BODY_TIMEOUT 60
+#define DEFAULT_IDLE_TIMEOUT 75
+#define DEFAULT_WRITE_TIMEOUT 60
+#define DEFAULT_RETRY_AFTER 5
+#define DEFAULT_ACCEPT_BATCH 64
+#define DEFAULT_MAX_HEADER 16384
+#define DEFAULT_MAX_HEADERS 100
+#define DEFAULT_MAX_URI 8192
+
 static void usage_exit() {
 	puts("usage: tinn [OPTIONS] [content_directory]\n");
-	puts("When not specified the content directory defaults to the current directory.\n");
+	puts("When not specified the content directory defaults to the current directory.");
+	puts("Sending SIGUSR2 starts the binary again, handing over the server sockets, and exits");
+	puts("once open connections finish, so a new build can be deployed without dropping any.\n");
 	puts("Options:");
-	puts("  -h, --help         Display this help.");
-	puts("      --version      Display version.");
-	puts("  -v, --verbose      Enable verbose logging.");
-	puts("  -p port            Port to listen on, defaults to 8080.");
+	puts("  -h, --help              Display this help.");
+	puts("      --version           Display version.");
+	puts("  -v, --verbose           Enable verbose logging.");
+	puts("  -p port                 Port to listen on, defaults to 8080.");
+	puts("      --listen addr       Listen on a port or unix:/path, can be repeated.  Only these");
+	puts("                          are used unless -p is given too.  With ,proxy on the end");
+	puts("                          connections to it start with a PROXY protocol header, giving");
+	puts("                          the real client address behind a load balancer.");
+	puts("      --proxy-protocol    Expect a PROXY protocol header on every listener.");
+	puts("  -t threads              Number of event loop threads, defaults to 1.");
+	puts("      --backend name      Event backend, epoll (default on Linux), poll or io_uring.");
+	puts("      --events n          Maximum events handled per wakeup, defaults to " STR(SOCKETS_DEFAULT_EVENTS) ".");
+	puts("      --workers n         Threads for file system work, defaults to " STR(WORKERS_DEFAULT_THREADS) ", 0 does it on the");
+	puts("                          event loop threads.");
+	puts("      --uri-cache n       Request targets kept parsed and resolved per thread, defaults");
+	puts("                          to " STR(URI_CACHE_DEFAULT_SIZE) ", 0 disables it.");
+	puts("      --header-timeout s  Seconds allowed to send a request header, defaults to " STR(DEFAULT_HEADER_TIMEOUT) ".");
+	puts("      --body-timeout s    Seconds allowed between pieces of a request body, defaults to " STR(DEFAULT_BODY_TIMEOUT) ".");
+	puts("      --idle-timeout s    Seconds an idle connection is kept open, defaults to " STR(DEFAULT_IDLE_TIMEOUT) ".");
+	puts("      --write-timeout s   Seconds allowed between pieces of a response, defaults to " STR(DEFAULT_WRITE_TIMEOUT) ".");
+	puts("                          A timeout of 0 disables it.");
+	puts("      --max-connections n Stop accepting at this many connections, defaults to off.");
+	puts("      --soft-limit n      Turn away connections past this many with 503, defaults to off.");
+	puts("      --max-requests n    Turn away requests past this many being answered with 503,");
+	puts("                          defaults to off.");
+	puts("                          A limit of 0 disables it, limits are shared between threads.");
+	puts("      --retry-after s     Seconds 503 responses ask clients to wait, defaults to " STR(DEFAULT_RETRY_AFTER) ".");
+	puts("      --max-header n      Largest request header in bytes, answered with 431 past it,");
+	puts("                          defaults to " STR(DEFAULT_MAX_HEADER) ".");
+	puts("      --max-headers n     Most header lines in a request, defaults to " STR(DEFAULT_MAX_HEADERS) ".");
+	puts("      --max-uri n         Longest request target in bytes, answered with 414 past it,");
+	puts("                          defaults to " STR(DEFAULT_MAX_URI) ".  A limit of 0 disables it.");
+	puts("      --backlog n         Connections the kernel queues for us, defaults to " STR(SOCKETS_DEFAULT_BACKLOG) ".");
+	puts("      --accept-batch n    Connections accepted per wakeup, defaults to " STR(DEFAULT_ACCEPT_BATCH) ".");
+	puts("      --defer-accept s    Seconds the kernel holds new connections until they send");
+	puts("                          something, defaults to off.");
+	puts("      --fastopen n        Enable TCP fast open with a queue of n, defaults to off.");
+	puts("      --nodelay           Disable Nagle's algorithm on connections.");
+	puts("      --zerocopy n        Send generated bodies, or pieces of streamed ones, of n bytes");
+	puts("                          or more with MSG_ZEROCOPY, epoll and poll only, defaults to off.");
 	exit(EXIT_SUCCESS);
 }
 
@@ -27,13 +83,68 @@ static void version_exit() {
 
 struct settings_t {
 	char* port;
+	bool port_set;
+	int listen_count;
+	char** listen;
 	char* content_dir;
+	const SocketsBackend* backend;
+	int max_events;
+	int threads;
+	int workers;
+	size_t uri_cache;
+	ServerSocketOptions server;
+	ClientConfig client;
 };
 
+// read a limit, 0 for none
+static bool parse_limit(char* value, size_t* limit) {
+	char* end;
+	long n = strtol(value, &end, 10);
+	if (*end != '\0' || n < 0) {
+		return false;
+	}
+	*limit = n;
+	return true;
+}
+
+// read a number of seconds as milliseconds
+static bool parse_timeout(char* value, int* timeout) {
+	char* end;
+	long seconds = strtol(value, &end, 10);
+	if (*end != '\0' || seconds < 0 || seconds > 86400) {
+		return false;
+	}
+	*timeout = seconds * 1000;
+	return true;
+}
+
 static struct settings_t parse_arguments(int count, char* values[]) {
 	struct settings_t settings = {
 		.port = "8080",
-		.content_dir = "."
+		.listen_count = 0,
+		.listen = NULL,
+		.content_dir = ".",
+		.backend = sockets_backend(NULL),
+		.max_events = SOCKETS_DEFAULT_EVENTS,
+		.threads = 1,
+		.workers = WORKERS_DEFAULT_THREADS,
+		.uri_cache = URI_CACHE_DEFAULT_SIZE,
+		.server = {
+			.backlog = SOCKETS_DEFAULT_BACKLOG
+		},
+		.client = {
+			.header_timeout = DEFAULT_HEADER_TIMEOUT * 1000,
+			.body_timeout = DEFAULT_BODY_TIMEOUT * 1000,
+			.idle_timeout = DEFAULT_IDLE_TIMEOUT * 1000,
+			.write_timeout = DEFAULT_WRITE_TIMEOUT * 1000,
+			.retry_after = DEFAULT_RETRY_AFTER,
+			.accept_batch = DEFAULT_ACCEPT_BATCH,
+			.limits = {
+				.max_header = DEFAULT_MAX_HEADER,
+				.max_headers = DEFAULT_MAX_HEADERS,
+				.max_uri = DEFAULT_MAX_URI
+			}
+		}
 	};
 	bool set_content_dir = false;
 
@@ -50,6 +161,118 @@ static struct settings_t parse_arguments(int count, char* values[]) {
 					version_exit();
 				} else if (strcmp(values[i], "--verbose")==0) {
 					clevel = CL_TRACE;
+				} else if (strcmp(values[i], "--backend")==0) {
+					if (i==count-1 || (settings.backend = sockets_backend(values[i+1])) == NULL) {
+						usage_exit();
+					}
+					i++;
+				} else if (strcmp(values[i], "--events")==0) {
+					if (i==count-1 || (settings.max_events = atoi(values[i+1])) <= 0) {
+						usage_exit();
+					}
+					i++;
+				} else if (strcmp(values[i], "--workers")==0) {
+					char* end;
+					if (i==count-1 || (settings.workers = strtol(values[i+1], &end, 10)) < 0 || *end != '\0') {
+						usage_exit();
+					}
+					i++;
+				} else if (strcmp(values[i], "--uri-cache")==0) {
+					if (i==count-1 || !parse_limit(values[i+1], &settings.uri_cache)) {
+						usage_exit();
+					}
+					i++;
+				} else if (strcmp(values[i], "--header-timeout")==0) {
+					if (i==count-1 || !parse_timeout(values[i+1], &settings.client.header_timeout)) {
+						usage_exit();
+					}
+					i++;
+				} else if (strcmp(values[i], "--body-timeout")==0) {
+					if (i==count-1 || !parse_timeout(values[i+1], &settings.client.body_timeout)) {
+						usage_exit();
+					}
+					i++;
+				} else if (strcmp(values[i], "--idle-timeout")==0) {
+					if (i==count-1 || !parse_timeout(values[i+1], &settings.client.idle_timeout)) {
+						usage_exit();
+					}
+					i++;
+				} else if (strcmp(values[i], "--write-timeout")==0) {
+					if (i==count-1 || !parse_timeout(values[i+1], &settings.client.write_timeout)) {
+						usage_exit();
+					}
+					i++;
+				} else if (strcmp(values[i], "--max-connections")==0) {
+					if (i==count-1 || !parse_limit(values[i+1], &settings.client.max_connections)) {
+						usage_exit();
+					}
+					i++;
+				} else if (strcmp(values[i], "--soft-limit")==0) {
+					if (i==count-1 || !parse_limit(values[i+1], &settings.client.soft_connections)) {
+						usage_exit();
+					}
+					i++;
+				} else if (strcmp(values[i], "--max-requests")==0) {
+					if (i==count-1 || !parse_limit(values[i+1], &settings.client.max_requests)) {
+						usage_exit();
+					}
+					i++;
+				} else if (strcmp(values[i], "--max-header")==0) {
+					if (i==count-1 || !parse_limit(values[i+1], &settings.client.limits.max_header)) {
+						usage_exit();
+					}
+					i++;
+				} else if (strcmp(values[i], "--max-headers")==0) {
+					if (i==count-1 || !parse_limit(values[i+1], &settings.client.limits.max_headers)) {
+						usage_exit();
+					}
+					i++;
+				} else if (strcmp(values[i], "--max-uri")==0) {
+					if (i==count-1 || !parse_limit(values[i+1], &settings.client.limits.max_uri)) {
+						usage_exit();
+					}
+					i++;
+				} else if (strcmp(values[i], "--zerocopy")==0) {
+					if (i==count-1 || !parse_limit(values[i+1], &settings.client.zerocopy_min)) {
+						usage_exit();
+					}
+					i++;
+				} else if (strcmp(values[i], "--retry-after")==0) {
+					if (i==count-1 || (settings.client.retry_after = atoi(values[i+1])) < 0) {
+						usage_exit();
+					}
+					i++;
+				} else if (strcmp(values[i], "--backlog")==0) {
+					if (i==count-1 || (settings.server.backlog = atoi(values[i+1])) <= 0) {
+						usage_exit();
+					}
+					i++;
+				} else if (strcmp(values[i], "--accept-batch")==0) {
+					if (i==count-1 || (settings.client.accept_batch = atoi(values[i+1])) <= 0) {
+						usage_exit();
+					}
+					i++;
+				} else if (strcmp(values[i], "--defer-accept")==0) {
+					if (i==count-1 || (settings.server.defer_accept = atoi(values[i+1])) <= 0) {
+						usage_exit();
+					}
+					i++;
+				} else if (strcmp(values[i], "--fastopen")==0) {
+					if (i==count-1 || (settings.server.fastopen = atoi(values[i+1])) <= 0) {
+						usage_exit();
+					}
+					i++;
+				} else if (strcmp(values[i], "--nodelay")==0) {
+					settings.server.nodelay = true;
+				} else if (strcmp(values[i], "--listen")==0) {
+					if (i==count-1 || values[i+1][0] == '\0') {
+						usage_exit();
+					}
+					settings.listen = allocate(settings.listen, sizeof(*settings.listen) * (settings.listen_count + 1));
+					settings.listen[settings.listen_count++] = values[i+1];
+					i++;
+				} else if (strcmp(values[i], "--proxy-protocol")==0) {
+					settings.server.proxy_protocol = true;
 				}
 			} else {
 				if (values[i][1] == 'h') {
@@ -61,6 +284,12 @@ static struct settings_t parse_arguments(int count, char* values[]) {
 						usage_exit();
 					}
 					settings.port = values[i+1];
+					settings.port_set = true;
+					i++;
+				} else if (values[i][1] == 't') {
+					if (i==count-1 || (settings.threads = atoi(values[i+1])) <= 0) {
+						usage_exit();
+					}
 					i++;
 				} else {
 					usage_exit();
@@ -78,61 +307,276 @@ static struct settings_t parse_arguments(int count, char* values[]) {
 	return settings;
 }
 
-// ================ Main loop etc ================
-int main(int argc, char* argv[]) {
-	// parse/validate settings
-	struct settings_t settings = parse_arguments(argc, argv);
+// ================ Reactors ================
+// each reactor is an event loop with its own server socket, list of sockets and content
+// generators, so nothing is shared between threads.  When there is more than one they
+// all bind the same port with SO_REUSEPORT and the kernel spreads connections between them,
+// a unix socket can't be bound more than once so they share one.
+// Admission limits are split between reactors and each counts its own load.
+struct server_socket_t {
+	int socket;
+	bool proxy_protocol;
+};
 
-	LOG("Tinn %s (%s)", VERSION, BUILD_DATE);
-	
-	// change working directory to content directory
-	if (chdir(settings.content_dir) != 0) {
-		ERROR("invalid content directory (%s)", settings.content_dir);
-		return EXIT_FAILURE;
+struct reactor_t {
+	int id;
+	pthread_t thread;
+	struct settings_t* settings;
+	ClientConfig client;
+	ClientLoad load;
+
+	size_t server_count;
+	struct server_socket_t* server_sockets;
+};
+
+static size_t share_limit(size_t limit, int threads) {
+	return limit == 0 ? 0 : (limit + threads - 1) / threads;
+}
+
+static void add_server_socket(struct reactor_t* reactor, int socket, bool proxy_protocol) {
+	reactor->server_sockets = allocate(reactor->server_sockets, sizeof(*reactor->server_sockets) * (reactor->server_count + 1));
+	reactor->server_sockets[reactor->server_count++] = (struct server_socket_t){.socket = socket, .proxy_protocol = proxy_protocol};
+}
+
+// every reactor gets one of the sockets in a group listening on the same address, if there
+// are too few they are shared.  Only the originals are handed over on an upgrade, the copies
+// close on exec
+static void share_server_sockets(int threads, struct reactor_t reactors[], int group[], size_t count, bool proxy_protocol) {
+	size_t n = count > (size_t)threads ? count : (size_t)threads;
+	for (size_t i=0; i<n; i++) {
+		int socket = i < count ? group[i] : fcntl(group[i % count], F_DUPFD_CLOEXEC, 0);
+		if (socket < 0) {
+			PANIC("sharing server socket");
+		}
+		add_server_socket(&reactors[i % threads], socket, proxy_protocol);
 	}
-	
-	// create content generators
-	TRACE("creating list of content generators");
+}
+
+static bool same_address(int a, int b) {
+	struct sockaddr_storage first, second;
+	socklen_t first_len = sizeof(first), second_len = sizeof(second);
+	memset(&first, 0, sizeof(first));
+	memset(&second, 0, sizeof(second));
+	if (getsockname(a, (struct sockaddr*)&first, &first_len) != 0 || getsockname(b, (struct sockaddr*)&second, &second_len) != 0) {
+		return false;
+	}
+	return first_len == second_len && memcmp(&first, &second, first_len) == 0;
+}
+
+// ones inherited from an upgrade are grouped by address and shared out
+static void inherit_server_sockets(struct settings_t* settings, struct reactor_t reactors[]) {
+	size_t inherited = upgrade_inherited_count();
+	LOG("using %ld server socket%s from the previous process", inherited, inherited > 1 ? "s" : "");
+
+	bool grouped[inherited];
+	int group[inherited];
+	memset(grouped, 0, sizeof(grouped));
+	for (size_t i=0; i<inherited; i++) {
+		if (grouped[i]) {
+			continue;
+		}
+		size_t count = 0;
+		for (size_t j=i; j<inherited; j++) {
+			if (!grouped[j] && (j == i || same_address(upgrade_inherited(i), upgrade_inherited(j)))) {
+				grouped[j] = true;
+				group[count++] = upgrade_inherited(j);
+				upgrade_add_server(upgrade_inherited(j), upgrade_inherited_proxy(j));
+			}
+		}
+		share_server_sockets(settings->threads, reactors, group, count, upgrade_inherited_proxy(i));
+	}
+}
+
+static void open_port(struct settings_t* settings, struct reactor_t reactors[], char* port, ServerSocketOptions options) {
+	options.reuse_port = settings->threads > 1;
+	for (int i=0; i<settings->threads; i++) {
+		TRACE("opening server socket on %s for reactor %d", port, i);
+		int socket = get_server_socket(port, &options);
+		if (socket < 0) {
+			PANIC("getting server socket");
+		}
+		add_server_socket(&reactors[i], socket, options.proxy_protocol);
+		upgrade_add_server(socket, options.proxy_protocol);
+	}
+}
+
+static void open_unix(struct settings_t* settings, struct reactor_t reactors[], char* path, ServerSocketOptions options) {
+	TRACE("opening unix socket %s", path);
+	int socket = get_unix_server_socket(path, &options);
+	if (socket < 0) {
+		PANIC("getting unix server socket");
+	}
+	upgrade_add_server(socket, options.proxy_protocol);
+	share_server_sockets(settings->threads, reactors, &socket, 1, options.proxy_protocol);
+}
+
+// server sockets are opened before the reactors start, so they can be handed on in an upgrade
+static void open_server_sockets(struct settings_t* settings, struct reactor_t reactors[]) {
+	if (upgrade_inherited_count() > 0) {
+		inherit_server_sockets(settings, reactors);
+		return;
+	}
+
+	if (settings->listen_count == 0 || settings->port_set) {
+		open_port(settings, reactors, settings->port, settings->server);
+	}
+	for (int i=0; i<settings->listen_count; i++) {
+		// "addr,proxy" is a listener behind a proxy
+		char listen[strlen(settings->listen[i]) + 1];
+		strcpy(listen, settings->listen[i]);
+		ServerSocketOptions options = settings->server;
+		char* suffix = strrchr(listen, ',');
+		if (suffix != NULL && strcmp(suffix, ",proxy") == 0) {
+			*suffix = '\0';
+			options.proxy_protocol = true;
+		}
+
+		if (strncmp(listen, "unix:", 5) == 0) {
+			open_unix(settings, reactors, listen + 5, options);
+		} else {
+			open_port(settings, reactors, listen, options);
+		}
+	}
+}
+
+static ContentGenerators* create_content_generators() {
 	ContentGenerators* content = content_generators_new(2);
 
-	Blog* blog = blog_new();
+	BlogState* blog = blog_state_new();
 	if (blog != NULL) {
 		content_generators_add(content, blog_content, blog);
 	}
 	
 	content_generators_add(content, static_content, NULL);
+
+	return content;
+}
+
+// woken by a signal, the first reactor starts an upgrade and then they all drain
+static void wake_listener(Sockets* sockets, int index) {
+	struct reactor_t* reactor = sockets->states[index];
+	upgrade_clear_wake(reactor->id);
+
+	if (upgrade_requested()) {
+		LOG("upgrade requested");
+		upgrade_start();
+	}
+
+	if (upgrade_draining() && !reactor->load.draining) {
+		TRACE("draining reactor %d", reactor->id);
+		server_stop(sockets, &reactor->load);
+		client_drain(sockets, &reactor->load);
+	}
+}
+
+static void* run_reactor(void* arg) {
+	struct reactor_t* reactor = arg;
+	struct settings_t* settings = reactor->settings;
+
+	// create content generators
+	TRACE("creating list of content generators for reactor %d", reactor->id);
+	ContentGenerators* content = create_content_generators();
 	
 	// create list of sockets
-	TRACE("creating list of sockets");
-	Sockets* sockets = sockets_new();
-	
-	// open server socket
-	TRACE("opening server socket");
-	int server_socket = get_server_socket(settings.port);
-	if (server_socket < 0) {
-		ERROR("getting server socket");
-		return EXIT_FAILURE;
+	TRACE("creating list of sockets for reactor %d", reactor->id);
+	Sockets* sockets = sockets_new(settings->backend, settings->max_events);
+
+	client_load_init(&reactor->load, CLIENT_SPARE_START);
+	for (size_t i=0; i<reactor->server_count; i++) {
+		server_new(sockets, reactor->server_sockets[i].socket, reactor->server_sockets[i].proxy_protocol, content, &reactor->client, &reactor->load);
 	}
 
-	server_new(sockets, server_socket, content);
-	LOG("waiting for connections");
+	int wake = sockets_add(sockets, upgrade_wake_fd(reactor->id), wake_listener);
+	sockets->states[wake] = reactor;
+	int done = sockets_add(sockets, reactor->load.done->fd, client_done_listener);
+	sockets->states[done] = &reactor->load;
 
-	// loop forever directing network traffic
-	for (;;) {
-		if (poll(sockets->pollfds, sockets->count, -1) < 0 ) {
-			PANIC("when polling");
+	// targets kept parsed and resolved, dropped when the content changes
+	int watch = -1;
+	if (settings->uri_cache > 0) {
+		reactor->load.uris = uri_cache_new(settings->uri_cache);
+		if (reactor->load.uris->watch_fd >= 0) {
+			watch = sockets_add(sockets, reactor->load.uris->watch_fd, uri_cache_listener);
+			sockets->states[watch] = reactor->load.uris;
 		}
+	}
 
-		for (size_t i = 0; i < sockets->count; i++) {
-			if (sockets->pollfds[i].revents) {
-				sockets->listeners[i](sockets, i);
-			}
+	// direct network traffic until drained for an upgrade, and the workers are done with us
+	while (!reactor->load.draining || reactor->load.connections > 0 || reactor->load.servers_count > 0 || reactor->load.waiting > 0) {
+		if (sockets_dispatch(sockets, -1) < 0) {
+			PANIC("when polling");
 		}
 	}
+	TRACE("reactor %d finished", reactor->id);
 
-	// tidy up, but we should never get here?
-	close(server_socket);
+	// tidy up
+	sockets_rm(sockets, wake);
+	sockets_rm(sockets, done);
+	if (watch >= 0) {
+		sockets_rm(sockets, watch);
+	}
+	uri_cache_free(reactor->load.uris);
+	client_load_free(&reactor->load);
+	sockets_free(sockets);
 	content_generators_free(content);
+	free(reactor->server_sockets);
+
+	return NULL;
+}
+
+// ================ Main loop etc ================
+int main(int argc, char* argv[]) {
+	// parse/validate settings
+	struct settings_t settings = parse_arguments(argc, argv);
+
+	LOG("Tinn %s (%s)", VERSION, BUILD_DATE);
+
+	// sendfile can't be told not to raise SIGPIPE like send can
+	signal(SIGPIPE, SIG_IGN);
+
+	// before changing directory, so the binary can be found again
+	upgrade_init(argv, settings.threads);
+
+	client_config_prepare(&settings.client);
+	settings.client.workers = settings.workers > 0 ? workers_new(settings.workers, WORKERS_DEFAULT_QUEUE) : NULL;
+
+	// server sockets are opened before changing directory too, so unix socket paths are
+	// relative to where we were started
+	struct reactor_t reactors[settings.threads];
+	for (int i=0; i<settings.threads; i++) {
+		reactors[i].id = i;
+		reactors[i].settings = &settings;
+		reactors[i].client = settings.client;
+		reactors[i].client.max_connections = share_limit(settings.client.max_connections, settings.threads);
+		reactors[i].client.soft_connections = share_limit(settings.client.soft_connections, settings.threads);
+		reactors[i].client.max_requests = share_limit(settings.client.max_requests, settings.threads);
+		reactors[i].server_count = 0;
+		reactors[i].server_sockets = NULL;
+	}
+	open_server_sockets(&settings, reactors);
+
+	// change working directory to content directory
+	if (chdir(settings.content_dir) != 0) {
+		ERROR("invalid content directory (%s)", settings.content_dir);
+		return EXIT_FAILURE;
+	}
+
+	// start reactors, the main thread runs the first one
+
+	for (int i=1; i<settings.threads; i++) {
+		if (pthread_create(&reactors[i].thread, NULL, run_reactor, &reactors[i]) != 0) {
+			ERROR("starting reactor %d", i);
+			return EXIT_FAILURE;
+		}
+	}
+
+	LOG("waiting for connections on %d thread%s", settings.threads, settings.threads > 1 ? "s" : "");
+	run_reactor(&reactors[0]);
+
+	for (int i=1; i<settings.threads; i++) {
+		pthread_join(reactors[i].thread, NULL);
+	}
+	workers_free(settings.client.workers);
 	
 	return EXIT_SUCCESS;
-}
+}
\ No newline at end of file
@@ -0,0 +1,288 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+#include "utils.h"
+#include "console.h"
+#include "upgrade.h"
+
+extern char** environ;
+
+static char** arguments;
+static char binary[PATH_MAX];
+static char directory[PATH_MAX];
+
+static size_t inherited_count = 0;
+static int* inherited = NULL;
+static bool* inherited_proxy = NULL;
+
+static size_t servers_size = 0;
+static size_t servers_count = 0;
+static int* servers = NULL;
+static bool* servers_proxy = NULL;
+
+static int reactor_count = 0;
+static int* wake_read = NULL;
+static int* wake_write = NULL;
+
+static atomic_bool requested = false;
+static atomic_bool draining = false;
+
+static bool close_on_exec(int fd) {
+	int flags = fcntl(fd, F_GETFD, 0);
+	return flags >= 0 && fcntl(fd, F_SETFD, flags | FD_CLOEXEC) == 0;
+}
+
+// only listening sockets are any use to us
+static bool is_server_socket(int fd) {
+	int listening = 0;
+	socklen_t size = sizeof(listening);
+	return getsockopt(fd, SOL_SOCKET, SO_ACCEPTCONN, &listening, &size) == 0 && listening;
+}
+
+// read the server sockets a previous process left us
+static void read_inherited() {
+	char* value = getenv(UPGRADE_ENV);
+	if (value == NULL) {
+		return;
+	}
+
+	size_t size = 1;
+	for (char* c = value; *c; c++) {
+		if (*c == ',') {
+			size++;
+		}
+	}
+	inherited = allocate(NULL, sizeof(*inherited) * size);
+	inherited_proxy = allocate(NULL, sizeof(*inherited_proxy) * size);
+
+	char* end;
+	while (*value) {
+		long fd = strtol(value, &end, 10);
+		if (end == value || fd < 0 || fd > INT_MAX) {
+			WARN("invalid %s, ignoring the rest", UPGRADE_ENV);
+			break;
+		}
+		bool proxy = *end == 'p';
+		if (proxy) {
+			end++;
+		}
+		if (is_server_socket(fd) && close_on_exec(fd)) {
+			inherited_proxy[inherited_count] = proxy;
+			inherited[inherited_count++] = fd;
+		} else {
+			WARN("inherited descriptor %ld is not a server socket", fd);
+		}
+		value = *end == ',' ? end + 1 : end;
+	}
+
+	// anything we start gets its own list
+	unsetenv(UPGRADE_ENV);
+}
+
+static void on_signal(int signal) {
+	(void)signal; //un-used
+	int saved = errno;
+	atomic_store(&requested, true);
+	if (wake_write != NULL) {
+		ssize_t rv = write(wake_write[0], "u", 1);
+		(void)rv; // if the pipe is full a wake up is already waiting
+	}
+	errno = saved;
+}
+
+// call before changing directory, the binary is found again by its path so a new build
+// copied over the old one is what gets started, and it starts where we did so relative
+// paths in the arguments still work
+void upgrade_init(char* argv[], int reactors) {
+	arguments = argv;
+	if (getcwd(directory, sizeof(directory)) == NULL) {
+		directory[0] = '\0';
+	}
+	ssize_t len = readlink("/proc/self/exe", binary, sizeof(binary)-1);
+	if (len > 0) {
+		binary[len] = '\0';
+	} else if (realpath(argv[0], binary) == NULL) {
+		strncpy(binary, argv[0], sizeof(binary)-1);
+	}
+
+	read_inherited();
+
+	reactor_count = reactors;
+	wake_read = allocate(NULL, sizeof(*wake_read) * reactors);
+	wake_write = allocate(NULL, sizeof(*wake_write) * reactors);
+	for (int i=0; i<reactors; i++) {
+		int fds[2];
+		if (pipe(fds) != 0) {
+			PANIC("creating wake pipe");
+		}
+		for (int j=0; j<2; j++) {
+			int flags = fcntl(fds[j], F_GETFL, 0);
+			if (flags < 0 || fcntl(fds[j], F_SETFL, flags | O_NONBLOCK) != 0 || !close_on_exec(fds[j])) {
+				PANIC("setting up wake pipe");
+			}
+		}
+		wake_read[i] = fds[0];
+		wake_write[i] = fds[1];
+	}
+
+	struct sigaction action;
+	memset(&action, 0, sizeof(action));
+	action.sa_handler = on_signal;
+	sigemptyset(&action.sa_mask);
+	action.sa_flags = SA_RESTART;
+	if (sigaction(SIGUSR2, &action, NULL) != 0) {
+		WARN("unable to handle SIGUSR2, upgrades disabled");
+	}
+}
+
+size_t upgrade_inherited_count() {
+	return inherited_count;
+}
+
+int upgrade_inherited(size_t i) {
+	return i < inherited_count ? inherited[i] : -1;
+}
+
+// whether connections to an inherited socket start with a PROXY protocol header
+bool upgrade_inherited_proxy(size_t i) {
+	return i < inherited_count && inherited_proxy[i];
+}
+
+// server sockets to hand over, only added from the main thread before reactors start
+void upgrade_add_server(int socket, bool proxy_protocol) {
+	if (servers_count == servers_size) {
+		servers_size = servers_size ? servers_size * 2 : 4;
+		servers = allocate(servers, sizeof(*servers) * servers_size);
+		servers_proxy = allocate(servers_proxy, sizeof(*servers_proxy) * servers_size);
+	}
+	servers_proxy[servers_count] = proxy_protocol;
+	servers[servers_count++] = socket;
+}
+
+int upgrade_wake_fd(int reactor) {
+	return wake_read[reactor];
+}
+
+void upgrade_clear_wake(int reactor) {
+	char buf[16];
+	while (read(wake_read[reactor], buf, sizeof(buf)) > 0);
+}
+
+// true once for each SIGUSR2
+bool upgrade_requested() {
+	return atomic_exchange(&requested, false);
+}
+
+static char** build_environment() {
+	size_t count = 0;
+	while (environ[count] != NULL) {
+		count++;
+	}
+
+	char** env = allocate(NULL, sizeof(*env) * (count + 2));
+	size_t n = 0;
+	for (size_t i=0; i<count; i++) {
+		if (strncmp(environ[i], UPGRADE_ENV "=", strlen(UPGRADE_ENV "=")) != 0) {
+			env[n++] = environ[i];
+		}
+	}
+
+	size_t size = strlen(UPGRADE_ENV "=") + servers_count * 13 + 1;
+	char* value = allocate(NULL, size);
+	size_t len = snprintf(value, size, "%s=", UPGRADE_ENV);
+	for (size_t i=0; i<servers_count; i++) {
+		len += snprintf(value + len, size - len, i == 0 ? "%d%s" : ",%d%s", servers[i], servers_proxy[i] ? "p" : "");
+	}
+	env[n++] = value;
+	env[n] = NULL;
+	return env;
+}
+
+// only the last entry is ours
+static void free_environment(char** env) {
+	size_t n = 0;
+	while (env[n] != NULL) {
+		n++;
+	}
+	free(env[n-1]);
+	free(env);
+}
+
+// start the new binary and, once it's running, tell every reactor to drain
+bool upgrade_start() {
+	if (atomic_load(&draining)) {
+		WARN("already upgrading");
+		return false;
+	}
+
+	char** env = build_environment();
+
+	// the child reports an exec failure down this pipe, a successful exec just closes it
+	int status[2];
+	if (pipe(status) != 0 || !close_on_exec(status[0]) || !close_on_exec(status[1])) {
+		ERROR("creating upgrade pipe");
+		free_environment(env);
+		return false;
+	}
+
+	pid_t pid = fork();
+	if (pid == 0) {
+		// only async signal safe calls from here, other threads may have held locks.  The server
+		// sockets handed over are the only descriptors the new binary keeps
+		for (size_t i=0; i<servers_count; i++) {
+			fcntl(servers[i], F_SETFD, 0);
+		}
+		if (directory[0] == '\0' || chdir(directory) == 0) {
+			execve(binary, arguments, env);
+		}
+		int error = errno;
+		ssize_t rv = write(status[1], &error, sizeof(error));
+		(void)rv;
+		_exit(127);
+	}
+
+	close(status[1]);
+	free_environment(env);
+
+	if (pid < 0) {
+		close(status[0]);
+		ERROR("forking new binary");
+		return false;
+	}
+
+	int error;
+	ssize_t got;
+	do {
+		got = read(status[0], &error, sizeof(error));
+	} while (got < 0 && errno == EINTR);
+	close(status[0]);
+
+	if (got > 0) {
+		waitpid(pid, NULL, 0);
+		errno = error;
+		ERROR("starting %s", binary);
+		return false;
+	}
+
+	LOG("started %s (%d), finishing connections and exiting", binary, pid);
+	atomic_store(&draining, true);
+	for (int i=0; i<reactor_count; i++) {
+		ssize_t rv = write(wake_write[i], "d", 1);
+		(void)rv;
+	}
+	return true;
+}
+
+bool upgrade_draining() {
+	return atomic_load(&draining);
+}
@@ -0,0 +1,29 @@
+#ifndef TINN_UPGRADE_H
+#define TINN_UPGRADE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// upgrading to a new build without dropping connections.  SIGUSR2 starts the new binary with
+// the server sockets inherited and their descriptors listed in UPGRADE_ENV, then this process
+// stops accepting, finishes the connections it has and exits.  Each reactor has a wake pipe
+// so the signal can get it out of its wait.  A socket whose connections start with a PROXY
+// protocol header is listed with a p after it
+#define UPGRADE_ENV "TINN_LISTEN_FDS"
+
+void upgrade_init(char* argv[], int reactors);
+
+size_t upgrade_inherited_count();
+int upgrade_inherited(size_t i);
+bool upgrade_inherited_proxy(size_t i);
+
+void upgrade_add_server(int socket, bool proxy_protocol);
+
+int upgrade_wake_fd(int reactor);
+void upgrade_clear_wake(int reactor);
+
+bool upgrade_requested();
+bool upgrade_start();
+bool upgrade_draining();
+
+#endif
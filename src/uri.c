@@ -31,12 +31,11 @@ static bool remove_dot_segment(URI* uri, bool last) {
 	return true;
 }
 
-URI* uri_new(Token token) {
-	URI* uri = allocate(NULL, sizeof(*uri));
+URI* uri_new(Arena* arena, Token token) {
+	URI* uri = arena_alloc(arena, sizeof(*uri));
 
-	uri->data = allocate(NULL, token.length + 1);
-	memcpy(uri->data, token.start, token.length);
-	uri->data[token.length] = '\0';
+	uri->data = arena_strndup(arena, token.start, token.length);
+	uri->data_len = token.length + 1;
 
 	uri->path = NULL;
 	uri->path_len = 0;
@@ -44,7 +43,7 @@ URI* uri_new(Token token) {
 	uri->query_len = 0;
 
 	size_t max_segments = 8;
-	uri->segments = allocate(NULL, max_segments * sizeof(*uri->segments));
+	uri->segments = arena_alloc(arena, max_segments * sizeof(*uri->segments));
 	uri->segments_count = 0;
 
 	uri->valid = true;
@@ -62,8 +61,8 @@ URI* uri_new(Token token) {
 			case '/':
 				if (in_path) {
 					if (uri->segments_count == max_segments) {
+						uri->segments = arena_grow(arena, uri->segments, max_segments * sizeof(*uri->segments), max_segments * 2 * sizeof(*uri->segments));
 						max_segments *= 2;
-						uri->segments = allocate(uri->segments, max_segments * sizeof(*uri->segments));
 					}
 					uri->data[i] = '\0';
 					if (!remove_dot_segment(uri, false)) {
@@ -99,7 +98,7 @@ URI* uri_new(Token token) {
 		lens[i] = strlen(uri->segments[i]);
 		uri->path_len += 1 + lens[i];
 	}
-	uri->path = allocate(NULL, uri->path_len + 1);
+	uri->path = arena_alloc(arena, uri->path_len + 1);
 
 	size_t pos = 0;
 	for (size_t i=0; i<uri->segments_count; i++) {
@@ -112,14 +111,44 @@ URI* uri_new(Token token) {
 	// return URI
 	return uri;
 }
-void uri_free(URI* uri) {
-	if (uri != NULL) {
-		free(uri->data);
-		if (uri->path != NULL) {
-			free(uri->path);
-		}
-		free(uri->segments);
 
-		free(uri);
+size_t uri_packed_size(const URI* uri) {
+	return sizeof(*uri) + uri->segments_count * sizeof(*uri->segments) + uri->data_len + (uri->path != NULL ? uri->path_len + 1 : 0);
+}
+
+// the segments, then the data and the path
+void uri_pack(const URI* uri, void* block) {
+	URI* packed = block;
+	*packed = *uri;
+	packed->segments = (char**)(packed + 1);
+	packed->data = (char*)(packed->segments + uri->segments_count);
+	memcpy(packed->data, uri->data, uri->data_len);
+
+	for (size_t i=0; i<uri->segments_count; i++) {
+		packed->segments[i] = packed->data + (uri->segments[i] - uri->data);
+	}
+	packed->query = packed->data + (uri->query - uri->data);
+	if (uri->path != NULL) {
+		packed->path = packed->data + uri->data_len;
+		memcpy(packed->path, uri->path, uri->path_len + 1);
 	}
+}
+
+// a copy of a packed URI, only its own pointers need moving
+URI* uri_unpack(Arena* arena, const void* block, size_t size) {
+	const char* from = block;
+	char* to = arena_alloc(arena, size);
+	memcpy(to, block, size);
+
+	URI* uri = (URI*)to;
+	uri->segments = (char**)(uri + 1);
+	uri->data = to + (uri->data - from);
+	uri->query = to + (uri->query - from);
+	if (uri->path != NULL) {
+		uri->path = to + (uri->path - from);
+	}
+	for (size_t i=0; i<uri->segments_count; i++) {
+		uri->segments[i] = to + (uri->segments[i] - from);
+	}
+	return uri;
 }
\ No newline at end of file
@@ -3,10 +3,12 @@
 
 #include <stdbool.h>
 #include "scanner.h"
+#include "arena.h"
 
 typedef struct {
 	bool valid;
 	char* data;
+	size_t data_len; // with the null terminator
 	char* path;
 	size_t path_len;
 	char* query;
@@ -15,7 +17,12 @@ typedef struct {
 	size_t segments_count;
 } URI;
 
-URI* uri_new(Token token);
-void uri_free(URI* uri);
+// everything comes from the arena, so there is nothing to free
+URI* uri_new(Arena* arena, Token token);
+
+// a URI packed into one block that points into itself, to keep and copy back in one go
+size_t uri_packed_size(const URI* uri);
+void uri_pack(const URI* uri, void* block);
+URI* uri_unpack(Arena* arena, const void* block, size_t size);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,157 @@
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+
+#include "uri_cache.h"
+#include "utils.h"
+#include "console.h"
+
+// anything that changes what a directory holds, or a file in it
+#define WATCH_EVENTS (IN_MODIFY | IN_ATTRIB | IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | IN_DELETE_SELF | IN_MOVE_SELF | IN_MOVED_FROM | IN_MOVED_TO)
+
+// size is rounded up to a power of two sets
+UriCache* uri_cache_new(size_t size) {
+	UriCache* cache = allocate(NULL, sizeof(*cache));
+	cache->sets = 1;
+	while (cache->sets * URI_CACHE_WAYS < size) {
+		cache->sets *= 2;
+	}
+	cache->entries = allocate(NULL, sizeof(*cache->entries) * cache->sets * URI_CACHE_WAYS);
+	memset(cache->entries, 0, sizeof(*cache->entries) * cache->sets * URI_CACHE_WAYS);
+	cache->version = 1;
+	cache->used = 0;
+
+	cache->watch_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (cache->watch_fd < 0) {
+		ERROR("unable to watch for content changes, only parsed targets will be kept");
+	}
+	return cache;
+}
+
+void uri_cache_free(UriCache* cache) {
+	if (cache != NULL) {
+		for (size_t i=0; i<cache->sets * URI_CACHE_WAYS; i++) {
+			free(cache->entries[i].uri);
+		}
+		free(cache->entries);
+		if (cache->watch_fd >= 0) {
+			close(cache->watch_fd);
+		}
+		free(cache);
+	}
+}
+
+// FNV-1a
+static uint64_t hash_target(Token target) {
+	uint64_t hash = 14695981039346656037ULL;
+	for (size_t i=0; i<target.length; i++) {
+		hash ^= (unsigned char)target.start[i];
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
+static UriCacheEntry* find(UriCache* cache, Token target, uint64_t hash) {
+	UriCacheEntry* set = &cache->entries[(hash & (cache->sets - 1)) * URI_CACHE_WAYS];
+	for (int i=0; i<URI_CACHE_WAYS; i++) {
+		UriCacheEntry* entry = &set[i];
+		if (entry->version == cache->version && entry->hash == hash && entry->target_len == target.length && memcmp(entry->target, target.start, target.length) == 0) {
+			return entry;
+		}
+	}
+	return NULL;
+}
+
+// a copy of the target's URI in the arena and what it resolved to, NULL if it isn't kept
+URI* uri_cache_get(UriCache* cache, Arena* arena, Token target, UriResolution* resolution) {
+	if (target.length > URI_CACHE_MAX_TARGET) {
+		return NULL;
+	}
+	UriCacheEntry* entry = find(cache, target, hash_target(target));
+	if (entry == NULL) {
+		return NULL;
+	}
+	entry->used = ++cache->used;
+	*resolution = entry->resolution;
+	return uri_unpack(arena, entry->uri, entry->uri_size);
+}
+
+// keep a target just parsed, in place of one out of date or the least recently used
+void uri_cache_put(UriCache* cache, Token target, const URI* uri) {
+	if (target.length > URI_CACHE_MAX_TARGET) {
+		return;
+	}
+	uint64_t hash = hash_target(target);
+	UriCacheEntry* set = &cache->entries[(hash & (cache->sets - 1)) * URI_CACHE_WAYS];
+	UriCacheEntry* entry = &set[0];
+	for (int i=0; i<URI_CACHE_WAYS; i++) {
+		if (set[i].version != cache->version) {
+			entry = &set[i];
+			break;
+		}
+		if (set[i].used < entry->used) {
+			entry = &set[i];
+		}
+	}
+
+	entry->version = cache->version;
+	entry->used = ++cache->used;
+	entry->hash = hash;
+	entry->target_len = target.length;
+	memcpy(entry->target, target.start, target.length);
+
+	entry->uri_size = uri_packed_size(uri);
+	if (entry->uri_size > entry->uri_max) {
+		entry->uri_max = entry->uri_size;
+		entry->uri = allocate(entry->uri, entry->uri_max);
+	}
+	uri_pack(uri, entry->uri);
+
+	entry->resolution.generator = -1;
+	entry->resolution.note_size = 0;
+}
+
+// what answered a target, if it's still kept
+void uri_cache_resolve(UriCache* cache, Token target, const UriResolution* resolution) {
+	if (target.length > URI_CACHE_MAX_TARGET) {
+		return;
+	}
+	UriCacheEntry* entry = find(cache, target, hash_target(target));
+	if (entry != NULL) {
+		entry->resolution = *resolution;
+	}
+}
+
+// drop everything when path changes, a directory or a file in it.  Only the inotify fd is
+// used, so it's safe from the workers, false when it can't be watched and mustn't be kept
+bool uri_cache_watch(UriCache* cache, const char* path) {
+	if (cache->watch_fd < 0) {
+		return false;
+	}
+	if (inotify_add_watch(cache->watch_fd, path, WATCH_EVENTS) < 0) {
+		TRACE("unable to watch \"%s\"", path);
+		return false;
+	}
+	return true;
+}
+
+// something watched changed
+void uri_cache_listener(Sockets* sockets, int index) {
+	UriCache* cache = sockets->states[index];
+
+	_Alignas(struct inotify_event) char events[4096];
+	bool changed = false;
+	ssize_t got;
+	while ((got = read(cache->watch_fd, events, sizeof(events))) > 0) {
+		changed = true;
+	}
+	if (got < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+		ERROR("reading content changes");
+	}
+
+	if (changed) {
+		TRACE("content changed, dropping resolved targets");
+		cache->version++;
+	}
+}
@@ -0,0 +1,59 @@
+#ifndef TINN_URI_CACHE_H
+#define TINN_URI_CACHE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "scanner.h"
+#include "uri.h"
+#include "arena.h"
+#include "net.h"
+
+// request targets seen lately, kept parsed along with what answered them, so a repeat
+// request skips parsing its target and working out where its content comes from.  There's
+// one per reactor so nothing is locked.  It's a few ways per set, the least recently used way
+// making room, and everything is dropped when a watched directory changes
+#define URI_CACHE_DEFAULT_SIZE 1024
+#define URI_CACHE_WAYS 4
+#define URI_CACHE_MAX_TARGET 256 // longer targets aren't kept
+#define URI_CACHE_NOTE_SIZE 64
+
+// the content generator that answered a target and the note it left, see content_note
+typedef struct {
+	long generator; // -1 when not known
+	size_t note_size;
+	char note[URI_CACHE_NOTE_SIZE];
+} UriResolution;
+
+typedef struct {
+	unsigned long version; // out of date when it's not the cache's
+	unsigned long used;
+	uint64_t hash;
+	size_t target_len;
+	char target[URI_CACHE_MAX_TARGET];
+	size_t uri_size;
+	size_t uri_max;
+	URI* uri; // packed
+	UriResolution resolution;
+} UriCacheEntry;
+
+typedef struct {
+	size_t sets;
+	UriCacheEntry* entries;
+	unsigned long version;
+	unsigned long used;
+	int watch_fd; // inotify
+} UriCache;
+
+UriCache* uri_cache_new(size_t size);
+void uri_cache_free(UriCache* cache);
+
+URI* uri_cache_get(UriCache* cache, Arena* arena, Token target, UriResolution* resolution);
+void uri_cache_put(UriCache* cache, Token target, const URI* uri);
+void uri_cache_resolve(UriCache* cache, Token target, const UriResolution* resolution);
+
+bool uri_cache_watch(UriCache* cache, const char* path);
+void uri_cache_listener(Sockets* sockets, int index);
+
+#endif
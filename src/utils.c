@@ -1,3 +1,5 @@
+#define _DEFAULT_SOURCE
+
 #include <string.h>
 
 #include "utils.h"
@@ -11,20 +13,166 @@ void* allocate(void* data, size_t size) {
 	return new_data;
 }
 
-// generate a date stamp in Internet Messaging Format
+static const char day_names[7][4] = {"Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat"};
+static const char month_names[12][4] = {"Jan", "Feb", "Mar", "Apr", "May", "Jun", "Jul", "Aug", "Sep", "Oct", "Nov", "Dec"};
+
+// days since 1970-01-01 for a date in the proleptic Gregorian calendar, and back again.  Years
+// start in March so the leap day comes last, then it's whole 400 year eras
+static long days_from_civil(long year, int month, int day) {
+	year -= month <= 2;
+	long era = (year >= 0 ? year : year - 399) / 400;
+	long year_of_era = year - era * 400;
+	long day_of_year = (153 * (month > 2 ? month - 3 : month + 9) + 2) / 5 + day - 1;
+	long day_of_era = year_of_era * 365 + year_of_era / 4 - year_of_era / 100 + day_of_year;
+	return era * 146097 + day_of_era - 719468;
+}
+
+static void civil_from_days(long days, long* year, int* month, int* day) {
+	days += 719468;
+	long era = (days >= 0 ? days : days - 146096) / 146097;
+	long day_of_era = days - era * 146097;
+	long year_of_era = (day_of_era - day_of_era / 1460 + day_of_era / 36524 - day_of_era / 146096) / 365;
+	long day_of_year = day_of_era - (365 * year_of_era + year_of_era / 4 - year_of_era / 100);
+	long mp = (5 * day_of_year + 2) / 153;
+	*day = day_of_year - (153 * mp + 2) / 5 + 1;
+	*month = mp < 10 ? mp + 3 : mp - 9;
+	*year = year_of_era + era * 400 + (*month <= 2);
+}
+
+static void put_digits(char* out, long value, int width) {
+	for (int i=width-1; i>=0; i--) {
+		out[i] = '0' + value % 10;
+		value /= 10;
+	}
+}
+
+// generate a date stamp in Internet Messaging Format, "Sun, 06 Nov 1994 08:49:37 GMT".  The
+// same second tends to be asked for over and over, so the last one is kept
 char* to_imf_date(char* buf, size_t max_len, time_t seconds) {
-	strftime(buf, max_len, "%a, %d %b %Y %H:%M:%S GMT", gmtime(&seconds));
+	static _Thread_local time_t last_seconds = -1;
+	static _Thread_local char last[IMF_DATE_LEN];
+
+	if (max_len < IMF_DATE_LEN) {
+		if (max_len > 0) {
+			buf[0] = '\0';
+		}
+		return buf;
+	}
+	if (seconds == last_seconds) {
+		memcpy(buf, last, IMF_DATE_LEN);
+		return buf;
+	}
+
+	long days = seconds / 86400;
+	long time = seconds % 86400;
+	if (time < 0) {
+		days--;
+		time += 86400;
+	}
+	long year;
+	int month, day;
+	civil_from_days(days, &year, &month, &day);
+	if (year < 0 || year > 9999) {
+		struct tm tm;
+		gmtime_r(&seconds, &tm);
+		strftime(buf, max_len, "%a, %d %b %Y %H:%M:%S GMT", &tm);
+		return buf;
+	}
+
+	memcpy(buf, day_names[((days % 7) + 11) % 7], 3); // 1970-01-01 was a Thursday
+	memcpy(buf + 3, ", ", 2);
+	put_digits(buf + 5, day, 2);
+	buf[7] = ' ';
+	memcpy(buf + 8, month_names[month - 1], 3);
+	buf[11] = ' ';
+	put_digits(buf + 12, year, 4);
+	buf[16] = ' ';
+	put_digits(buf + 17, time / 3600, 2);
+	buf[19] = ':';
+	put_digits(buf + 20, time / 60 % 60, 2);
+	buf[22] = ':';
+	put_digits(buf + 23, time % 60, 2);
+	memcpy(buf + 25, " GMT", 5);
+
+	last_seconds = seconds;
+	memcpy(last, buf, IMF_DATE_LEN);
 	return buf;
 }
 
+// days in a month from 0, February depends on the year
+static int month_length(int year, int month) {
+	static const int lengths[12] = {31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
+	bool leap = year % 4 == 0 && (year % 100 != 0 || year % 400 == 0);
+	return lengths[month] + (month == 1 && leap);
+}
+
+// exactly width digits, -1 if they aren't
+static int get_digits(const char* in, int width) {
+	int value = 0;
+	for (int i=0; i<width; i++) {
+		if (in[i] < '0' || in[i] > '9') {
+			return -1;
+		}
+		value = value * 10 + (in[i] - '0');
+	}
+	return value;
+}
+
+// read a date in the fixed Internet Messaging Format, 0 if it isn't one.  Every field has a set
+// width so it's read in place, and the date is in GMT whatever the local time zone is
 time_t from_imf_date(const char* date, size_t len) {
-	struct tm tm;
-	memset(&tm, 0, sizeof(tm));
-	if (strptime(date, "%a, %d %b %Y %H:%M:%S GMT", &tm) == NULL) {
-		ERROR("Invalid IMF date (%.*s)", len, date);
+	if (len != IMF_DATE_LEN - 1 || date[3] != ',' || date[4] != ' ' || date[7] != ' ' || date[11] != ' '
+			|| date[16] != ' ' || date[19] != ':' || date[22] != ':' || memcmp(date + 25, " GMT", 4) != 0) {
+		TRACE("not an IMF date (%.*s)", (int)len, date);
+		return 0;
+	}
+
+	int weekday = 0;
+	while (weekday < 7 && memcmp(date, day_names[weekday], 3) != 0) {
+		weekday++;
+	}
+	int month = 0;
+	while (month < 12 && memcmp(date + 8, month_names[month], 3) != 0) {
+		month++;
+	}
+	int day = get_digits(date + 5, 2);
+	int year = get_digits(date + 12, 4);
+	int hour = get_digits(date + 17, 2);
+	int minute = get_digits(date + 20, 2);
+	int second = get_digits(date + 23, 2);
+	if (weekday == 7 || month == 12 || year < 0 || day < 1 || day > month_length(year, month) || hour < 0 || hour > 23 || minute < 0 || minute > 59 || second < 0 || second > 60) {
+		TRACE("not an IMF date (%.*s)", (int)len, date);
 		return 0;
 	}
-	return mktime(&tm);
+
+	return (time_t)days_from_civil(year, month + 1, day) * 86400 + hour * 3600 + minute * 60 + second;
+}
+
+static const char digit_pairs[201] =
+	"00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+	"40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+	"8081828384858687888990919293949596979899";
+
+// write a number in decimal without a terminator, returns how many digits, at most
+// DECIMAL_LEN.  Two digits at a time from the end, then moved to the front
+size_t to_decimal(char* buf, unsigned long long value) {
+	char digits[DECIMAL_LEN];
+	char* at = digits + DECIMAL_LEN;
+	while (value >= 100) {
+		at -= 2;
+		memcpy(at, digit_pairs + (value % 100) * 2, 2);
+		value /= 100;
+	}
+	if (value >= 10) {
+		at -= 2;
+		memcpy(at, digit_pairs + value * 2, 2);
+	} else {
+		*--at = '0' + value;
+	}
+
+	size_t length = digits + DECIMAL_LEN - at;
+	memcpy(buf, at, length);
+	return length;
 }
 
 const char* content_type(char* ext) {
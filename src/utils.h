@@ -4,8 +4,6 @@
 #define STRINGIZER(x) #x
 #define STR(x) STRINGIZER(x)
 
-#define __USE_XOPEN
-
 #include <stdlib.h>
 #include <stdbool.h>
 #include <time.h>
@@ -16,6 +14,9 @@ void* allocate(void* data, size_t size);
 char* to_imf_date(char* buf, size_t max_len, time_t seconds);
 time_t from_imf_date(const char* date, size_t len);
 
+#define DECIMAL_LEN 20 // digits in the largest unsigned 64 bit number
+size_t to_decimal(char* buf, unsigned long long value);
+
 const char* content_type(char* ext);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,162 @@
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+#include "utils.h"
+#include "console.h"
+#include "workers.h"
+
+static void finished(WorkersTask* task) {
+	WorkersDone* done = task->done;
+	task->next = NULL;
+
+	pthread_mutex_lock(&done->lock);
+	if (done->last == NULL) {
+		done->first = task;
+	} else {
+		done->last->next = task;
+	}
+	done->last = task;
+	pthread_mutex_unlock(&done->lock);
+
+	uint64_t one = 1;
+	ssize_t rv = write(done->fd, &one, sizeof(one));
+	(void)rv; // only fails if the count would overflow, it's readable either way
+}
+
+static void* run_worker(void* arg) {
+	Workers* workers = arg;
+
+	pthread_mutex_lock(&workers->lock);
+	for (;;) {
+		while (workers->first == NULL && !workers->stopping) {
+			pthread_cond_wait(&workers->ready, &workers->lock);
+		}
+		if (workers->first == NULL) {
+			break;
+		}
+
+		WorkersTask* task = workers->first;
+		workers->first = task->next;
+		if (workers->first == NULL) {
+			workers->last = NULL;
+		}
+		workers->queue_count--;
+		pthread_mutex_unlock(&workers->lock);
+
+		task->work(task->arg);
+		finished(task);
+
+		pthread_mutex_lock(&workers->lock);
+	}
+	pthread_mutex_unlock(&workers->lock);
+
+	return NULL;
+}
+
+Workers* workers_new(int threads, size_t queue_size) {
+	Workers* workers = allocate(NULL, sizeof(*workers));
+	pthread_mutex_init(&workers->lock, NULL);
+	pthread_cond_init(&workers->ready, NULL);
+	workers->stopping = false;
+
+	workers->queue_size = queue_size;
+	workers->queue_count = 0;
+	workers->first = NULL;
+	workers->last = NULL;
+
+	workers->thread_count = 0;
+	workers->threads = allocate(NULL, sizeof(*workers->threads) * threads);
+	for (int i=0; i<threads; i++) {
+		if (pthread_create(&workers->threads[i], NULL, run_worker, workers) != 0) {
+			PANIC("starting worker %d", i);
+		}
+		workers->thread_count++;
+	}
+
+	return workers;
+}
+
+// finishes anything queued first
+void workers_free(Workers* workers) {
+	if (workers != NULL) {
+		pthread_mutex_lock(&workers->lock);
+		workers->stopping = true;
+		pthread_cond_broadcast(&workers->ready);
+		pthread_mutex_unlock(&workers->lock);
+
+		for (int i=0; i<workers->thread_count; i++) {
+			pthread_join(workers->threads[i], NULL);
+		}
+
+		pthread_cond_destroy(&workers->ready);
+		pthread_mutex_destroy(&workers->lock);
+		free(workers->threads);
+		free(workers);
+	}
+}
+
+// queue a task with its work, arg, owner and done set, false if the queue is full and it's
+// up to the caller
+bool workers_submit(Workers* workers, WorkersTask* task) {
+	if (workers == NULL || workers->thread_count == 0) {
+		return false;
+	}
+
+	pthread_mutex_lock(&workers->lock);
+	if (workers->queue_count >= workers->queue_size || workers->stopping) {
+		pthread_mutex_unlock(&workers->lock);
+		return false;
+	}
+
+	task->next = NULL;
+
+	if (workers->last == NULL) {
+		workers->first = task;
+	} else {
+		workers->last->next = task;
+	}
+	workers->last = task;
+	workers->queue_count++;
+
+	pthread_cond_signal(&workers->ready);
+	pthread_mutex_unlock(&workers->lock);
+	return true;
+}
+
+WorkersDone* workers_done_new() {
+	WorkersDone* done = allocate(NULL, sizeof(*done));
+	done->fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (done->fd < 0) {
+		PANIC("creating eventfd");
+	}
+	pthread_mutex_init(&done->lock, NULL);
+	done->first = NULL;
+	done->last = NULL;
+	return done;
+}
+
+// only once nothing is left to finish
+void workers_done_free(WorkersDone* done) {
+	if (done != NULL) {
+		close(done->fd);
+		pthread_mutex_destroy(&done->lock);
+		free(done);
+	}
+}
+
+// take the list of finished tasks.  The eventfd is cleared first
+// so anything finishing after this wakes the reactor again
+WorkersTask* workers_done_take(WorkersDone* done) {
+	uint64_t count;
+	ssize_t rv = read(done->fd, &count, sizeof(count));
+	(void)rv; // EAGAIN when already cleared
+
+	pthread_mutex_lock(&done->lock);
+	WorkersTask* tasks = done->first;
+	done->first = NULL;
+	done->last = NULL;
+	pthread_mutex_unlock(&done->lock);
+
+	return tasks;
+}
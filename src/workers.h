@@ -0,0 +1,58 @@
+#ifndef TINN_WORKERS_H
+#define TINN_WORKERS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <pthread.h>
+
+// a pool of threads for blocking work, like reading files, so it doesn't hold up an event loop.
+// The queue is bounded, when it's full the work is refused and the caller does it itself.
+// Finished work goes back to the reactor that asked for it through its WorkersDone queue,
+// whose eventfd becomes readable.  Tasks belong to the caller, who can keep them for next time
+#define WORKERS_DEFAULT_THREADS 4
+#define WORKERS_DEFAULT_QUEUE 1024
+
+typedef void (*worker_fn)(void* arg);
+
+typedef struct workers_task WorkersTask;
+typedef struct workers_done WorkersDone;
+
+struct workers_task {
+	worker_fn work;
+	void* arg;
+	void* owner; // whatever asked, for when it's done
+	WorkersDone* done;
+	WorkersTask* next;
+};
+
+struct workers_done {
+	int fd;
+	pthread_mutex_t lock;
+	WorkersTask* first;
+	WorkersTask* last;
+};
+
+typedef struct {
+	pthread_mutex_t lock;
+	pthread_cond_t ready;
+	bool stopping;
+
+	size_t queue_size;
+	size_t queue_count;
+	WorkersTask* first;
+	WorkersTask* last;
+
+	int thread_count;
+	pthread_t* threads;
+} Workers;
+
+Workers* workers_new(int threads, size_t queue_size);
+void workers_free(Workers* workers);
+
+bool workers_submit(Workers* workers, WorkersTask* task);
+
+WorkersDone* workers_done_new();
+void workers_done_free(WorkersDone* done);
+WorkersTask* workers_done_take(WorkersDone* done);
+
+#endif